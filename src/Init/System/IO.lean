@@ -535,6 +535,101 @@ Waits until any of the tasks in the list has finished, then return its result.
     (h : tasks.length > 0 := by exact Nat.zero_lt_succ _) : BaseIO α :=
   return tasks[0].get
 
+/--
+Statistics about the Lean runtime's task manager, as returned by `IO.getTaskManagerStats`. Times are
+in nanoseconds and accumulated since the task manager was started. All fields except the
+`markMt` statistics are zero if the runtime is not using a task manager, e.g. with
+`LEAN_NUM_THREADS=0`. The `markMt` statistics are only collected while task tracing is enabled, see
+`IO.setTaskTracing`.
+-/
+structure TaskManagerStats where
+  /-- Number of standard worker threads that have been started. -/
+  numStdWorkers : Nat
+  /-- Number of standard worker threads currently waiting for work. -/
+  numIdleStdWorkers : Nat
+  /--
+  Current maximum number of concurrently running standard workers. It is temporarily increased while
+  a worker is blocked in `Task.get`.
+  -/
+  maxStdWorkers : Nat
+  /-- Number of running dedicated worker threads, see `Task.Priority.dedicated`. -/
+  numDedicatedWorkers : Nat
+  /-- Number of tasks currently queued, indexed by priority. -/
+  queued : Array Nat
+  /-- Number of task executions. -/
+  numTasksRun : Nat
+  /-- Number of times a worker blocked and the maximum number of running workers was increased. -/
+  numBlockedWorkers : Nat
+  /-- Total time tasks spent queued before running. -/
+  queuedTime : Nat
+  /-- Total time spent running tasks. -/
+  runTime : Nat
+  /-- Total time standard workers spent idle. -/
+  idleTime : Nat
+  /--
+  Number of times a value was marked as shared between threads, e.g. when passed to `Task.spawn`,
+  which requires traversing all objects reachable from it that are not yet marked.
+  -/
+  numMarkMtCalls : Nat
+  /-- Total number of objects marked as shared between threads. -/
+  numMarkMtObjs : Nat
+  /-- Largest number of objects marked by a single call. -/
+  maxMarkMtObjs : Nat
+  /-- Total time spent marking objects as shared between threads. -/
+  markMtTime : Nat
+  deriving Inhabited, Repr
+
+/-- Returns statistics about the Lean runtime's task manager. -/
+@[extern "lean_io_get_task_manager_stats"] opaque getTaskManagerStats : BaseIO TaskManagerStats
+
+/--
+Starts or stops recording task manager events, such as task executions and blocking waits, for
+`IO.writeTaskTrace`. Starting a recording discards all previously recorded events.
+-/
+@[extern "lean_io_set_task_tracing"] opaque setTaskTracing (enabled : Bool) : BaseIO Unit
+
+/--
+Writes the task manager events recorded since the last `IO.setTaskTracing true` to the given file
+in the Chrome trace event format, with one track per thread. The file can be viewed in
+[Perfetto](https://ui.perfetto.dev).
+-/
+@[extern "lean_io_write_task_trace"] opaque writeTaskTrace (fname : @& FilePath) : IO Unit
+
+/--
+Statistics about the Lean runtime's small object allocator, as returned by `IO.getAllocatorStats`.
+They are aggregated over the allocator heaps of all threads. If the runtime was built without the
+small object allocator, e.g. when using mimalloc, all other fields are zero and `liveObjs` is only
+available if it was built with `-DALLOC_STATS=ON`.
+-/
+structure AllocatorStats where
+  /-- Number of thread heaps, including heaps of finished threads that are kept for reuse. -/
+  numHeaps : Nat
+  /-- Number of memory segments allocated from the OS. -/
+  numSegments : Nat
+  /-- Number of segments backed by huge pages, see the `LEAN_HUGE_PAGES` environment variable. -/
+  numHugePageSegments : Nat
+  /-- Number of pages containing objects. -/
+  numPages : Nat
+  /-- Number of empty pages kept for reuse. -/
+  numEmptyPages : Nat
+  /-- Number of empty pages whose memory has been returned to the OS. -/
+  numDecommittedPages : Nat
+  /-- Number of objects deallocated by a thread other than the one that allocated them. -/
+  numRemoteFrees : Nat
+  /-- Number of allocations too large for the small object allocator. -/
+  numLargeAllocs : Nat
+  /-- Number of bytes currently allocated by large allocations. -/
+  largeBytes : Nat
+  /--
+  The object size and the number of live objects of each size class with live objects. Objects
+  deallocated by another thread may still be counted for a while.
+  -/
+  liveObjs : Array (Nat × Nat)
+  deriving Inhabited, Repr
+
+/-- Returns statistics about the Lean runtime's small object allocator. -/
+@[extern "lean_io_get_allocator_stats"] opaque getAllocatorStats : BaseIO AllocatorStats
+
 /--
 Returns the number of _heartbeats_ that have occurred during the current thread's execution. The
 heartbeat count is the number of “small” memory allocations performed in a thread.
@@ -8,9 +8,18 @@ Additional `Task` definitions.
 prelude
 import Init.Core
 import Init.Data.List.Basic
+import Init.Data.Array.Basic
 
 namespace Task
 
+/--
+Spawns one task for each function in `fns`, as if by `Task.spawn fn prio`, but queues all of them at
+once. This is cheaper than spawning the tasks one by one when launching many small tasks.
+-/
+@[noinline, extern "lean_task_spawn_many"]
+def spawnMany (fns : Array (Unit → α)) (prio := Task.Priority.default) : Array (Task α) :=
+  fns.map (Task.spawn · prio)
+
 /--
 Creates a task that, when all `tasks` have finished, computes the result of `f` applied to their
 results.
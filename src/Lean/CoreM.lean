@@ -26,6 +26,12 @@ register_builtin_option diagnostics.threshold : Nat := {
   descr    := "only diagnostic counters above this threshold are reported by the definitional equality"
 }
 
+register_builtin_option diagnostics.kernelStats : Bool := {
+  defValue := false
+  group    := "diagnostics"
+  descr    := "report counters and timers of the kernel reduction paths for each declaration checked by the kernel, when `diagnostics` is enabled"
+}
+
 register_builtin_option maxHeartbeats : Nat := {
   defValue := 200000
   descr := "maximum amount of heartbeats per command. A heartbeat is number of (small) memory allocations (in thousands), 0 means no limit"
@@ -167,8 +173,9 @@ instance : MonadWithOptions CoreM where
   withOptions f x := do
     let options := f (← read).options
     let diag := diagnostics.get options
-    if Kernel.isDiagnosticsEnabled (← getEnv) != diag then
-      modifyEnv fun env => Kernel.enableDiag env diag
+    let kernelStats := diag && diagnostics.kernelStats.get options
+    if Kernel.isDiagnosticsEnabled (← getEnv) != diag || Kernel.isDiagnosticsStatsEnabled (← getEnv) != kernelStats then
+      modifyEnv fun env => Kernel.enableDiag env diag kernelStats
     withReader
       (fun ctx =>
         { ctx with
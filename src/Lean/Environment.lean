@@ -111,6 +111,14 @@ def CompactedRegion := USize
 @[extern "lean_compacted_region_is_memory_mapped"]
 opaque CompactedRegion.isMemoryMapped : CompactedRegion → Bool
 
+/--
+  Returns `false` if the region references objects of other .olean files that are not loaded with the same
+  contents as when it was written (see `LEAN_OLEAN_SHARE_IMPORTS`), in which case its contents may not be
+  accessed. Otherwise, resolves these references, relocating them if a file could not be loaded at its
+  original address. -/
+@[extern "lean_compacted_region_has_valid_external_refs"]
+opaque CompactedRegion.hasValidExternalRefs : CompactedRegion → IO Bool
+
 /-- Free a compacted region and its contents. No live references to the contents may exist at the time of invocation. -/
 @[extern "lean_compacted_region_free"]
 unsafe opaque CompactedRegion.free : CompactedRegion → IO Unit
@@ -167,13 +175,67 @@ structure EnvironmentHeader where
 
 namespace Kernel
 
+/--
+Statistics about the reduction paths taken by the kernel while checking a declaration, see
+`Diagnostics.reductionStats`. Times are in nanoseconds, and recursive activations of a path are only
+timed at the outermost one.
+
+The field order is relied upon by `diagnostics::record_stats` in the kernel: it must match the order of
+`reduction_stats::counter` followed by `reduction_stats::timer` in `src/kernel/environment.h`.
+-/
+structure ReductionStats where
+  whnfCoreCalls        : Nat := 0
+  whnfCoreCacheHits    : Nat := 0
+  whnfCalls            : Nat := 0
+  whnfCacheHits        : Nat := 0
+  inferTypeCalls       : Nat := 0
+  inferTypeCacheHits   : Nat := 0
+  lazyDeltaSteps       : Nat := 0
+  /-- Number of times lazy delta reduction skipped comparing arguments because it failed before. -/
+  failureCacheHits     : Nat := 0
+  /-- Number of `Nat` operations on literals reduced by the kernel's GMP acceleration. -/
+  natReductions        : Nat := 0
+  /-- Number of `BitVec`, `UIntN` and `Fin` operations on literals reduced by the kernel's GMP acceleration. -/
+  fixedWidthReductions : Nat := 0
+  etaStructChecks      : Nat := 0
+  etaStructSuccesses   : Nat := 0
+  proofIrrelChecks     : Nat := 0
+  proofIrrelSuccesses  : Nat := 0
+  whnfCoreTime         : Nat := 0
+  whnfTime             : Nat := 0
+  lazyDeltaTime        : Nat := 0
+  natReductionTime     : Nat := 0
+  /-- Total time spent checking the declaration. -/
+  totalTime            : Nat := 0
+  deriving Inhabited
+
 structure Diagnostics where
   /-- Number of times each declaration has been unfolded by the kernel. -/
   unfoldCounter : PHashMap Name Nat := {}
+  /-- Reduction statistics of each declaration checked by the kernel. -/
+  reductionStats : PHashMap Name ReductionStats := {}
   /-- If `enabled = true`, kernel records declarations that have been unfolded. -/
   enabled : Bool := false
+  /-- If `enabled = true` and `collectStats = true`, kernel also records `reductionStats`. -/
+  collectStats : Bool := false
   deriving Inhabited
 
+private opaque SharedCacheImpl : NonemptyType.{0}
+
+/--
+A cache of kernel reduction and type inference results that is shared by all type checkers using an
+environment it is attached to, see `Environment.sharedCache?`. It can be used concurrently. It is only
+attached by `Lean.Environment.replay` and `Lean.Environment.replayParallel`. It is not used while kernel
+diagnostics are enabled, so that they count all unfoldings.
+-/
+def SharedCache : Type := SharedCacheImpl.type
+
+instance : Nonempty SharedCache := SharedCacheImpl.property
+
+/-- Creates a shared cache that holds about `maxEntries` results before evicting them. -/
+@[extern "lean_kernel_mk_shared_cache"]
+opaque SharedCache.new (maxEntries : USize) : BaseIO SharedCache
+
 /--
 An environment stores declarations provided by the user. The kernel
 currently supports different kinds of declarations such as definitions, theorems,
@@ -238,6 +300,16 @@ structure Environment where
   private extraConstNames : NameSet
   /-- The header contains additional information that is set at import time. -/
   header                  : EnvironmentHeader := {}
+  /--
+  If set, the type checker reuses the weak head normal forms and types it computes for terms without
+  free variables across declarations, and across all environments derived from this one.
+
+  This is only sound if these environments agree on all declarations they have in common, which holds
+  when they are all obtained by adding declarations to a single environment one after the other, such
+  as in `Lean.Environment.replay`, but not in general for environments of the elaborator, e.g. when
+  backtracking re-adds an auxiliary declaration with a different value.
+  -/
+  private sharedCache?    : Option SharedCache := none
 deriving Nonempty
 
 /-- Exceptions that can be raised by the kernel when type checking new declarations. -/
@@ -299,15 +371,25 @@ private def add (env : Environment) (cinfo : ConstantInfo) : Environment :=
 def Diagnostics.isEnabled (d : Diagnostics) : Bool :=
   d.enabled
 
-/-- Enables/disables kernel diagnostics. -/
-def enableDiag (env : Environment) (flag : Bool) : Environment :=
-  { env with diagnostics.enabled := flag }
+@[export lean_kernel_diag_stats_enabled]
+def Diagnostics.isStatsEnabled (d : Diagnostics) : Bool :=
+  d.enabled && d.collectStats
+
+/--
+Enables/disables kernel diagnostics. If `stats = true`, the kernel also collects `reductionStats`, which
+costs a clock read per reduction path taken.
+-/
+def enableDiag (env : Environment) (flag : Bool) (stats := false) : Environment :=
+  { env with diagnostics.enabled := flag, diagnostics.collectStats := stats }
 
 def isDiagnosticsEnabled (env : Environment) : Bool :=
   env.diagnostics.enabled
 
+def isDiagnosticsStatsEnabled (env : Environment) : Bool :=
+  env.diagnostics.isStatsEnabled
+
 def resetDiag (env : Environment) : Environment :=
-  { env with diagnostics.unfoldCounter := {} }
+  { env with diagnostics.unfoldCounter := {}, diagnostics.reductionStats := {} }
 
 @[export lean_kernel_record_unfold]
 def Diagnostics.recordUnfold (d : Diagnostics) (declName : Name) : Diagnostics :=
@@ -317,10 +399,28 @@ def Diagnostics.recordUnfold (d : Diagnostics) (declName : Name) : Diagnostics :
   else
     d
 
+@[export lean_kernel_record_stats]
+def Diagnostics.recordStats (d : Diagnostics) (declName : Name) (stats : ReductionStats) : Diagnostics :=
+  if d.isStatsEnabled then
+    { d with reductionStats := d.reductionStats.insert declName stats }
+  else
+    d
+
 @[export lean_kernel_get_diag]
 def getDiagnostics (env : Environment) : Diagnostics :=
   env.diagnostics
 
+@[export lean_kernel_get_shared_cache]
+private def getSharedCache? (env : Environment) : Option SharedCache :=
+  env.sharedCache?
+
+/--
+Attaches a shared cache to the environment, see `sharedCache?`, or detaches it. Unsafe as it is up to the
+caller to ensure that the cache is only used by a single chain of environments and detached afterwards.
+-/
+unsafe def setSharedCache (env : Environment) (cache? : Option SharedCache) : Environment :=
+  { env with sharedCache? := cache? }
+
 @[export lean_kernel_set_diag]
 def setDiagnostics (env : Environment) (diag : Diagnostics) : Environment :=
   { env with diagnostics := diag}
@@ -1616,8 +1716,14 @@ end MapDeclarationExtension
 
 @[extern "lean_save_module_data"]
 opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
+/--
+  Reads a module's `.olean` file. Except for `ModuleData.imports`, the result may not be accessed before
+  `CompactedRegion.hasValidExternalRefs` has been checked, after importing the modules it references. -/
 @[extern "lean_read_module_data"]
 opaque readModuleData (fname : @& System.FilePath) : IO (ModuleData × CompactedRegion)
+/-- Hints to the operating system that the given `.olean` file will be read soon. Best effort. -/
+@[extern "lean_prefetch_module_data"]
+opaque prefetchModuleData (fname : @& System.FilePath) : IO Unit
 
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
@@ -1745,6 +1851,8 @@ structure ImportState where
   moduleNames   : Array Name := #[]
   moduleData    : Array ModuleData := #[]
   regions       : Array CompactedRegion := #[]
+  /-- Background reads of `.olean` files that have not been consumed yet, see `importModulesCore`. -/
+  pendingReads  : Std.HashMap Name (Task (Except IO.Error (ModuleData × CompactedRegion))) := {}
 
 def throwAlreadyImported (s : ImportState) (const2ModIdx : Std.HashMap Name ModuleIdx) (modIdx : Nat) (cname : Name) : IO α := do
   let modName := s.moduleNames[modIdx]!
@@ -1756,15 +1864,50 @@ abbrev ImportStateM := StateRefT ImportState IO
 @[inline] nonrec def ImportStateM.run (x : ImportStateM α) (s : ImportState := {}) : IO (α × ImportState) :=
   x.run s
 
+/--
+Resolves the `.olean` file of `mod` and lets the OS start reading it in the background, so that the
+pages touched later, mostly by `finalizeImport`, are already in the page cache. Errors are reported
+when the file is actually read.
+-/
+private def prefetchImport (mod : Name) : IO (Option System.FilePath) := do
+  try
+    let mFile ← findOLean mod
+    prefetchModuleData mFile
+    return some mFile
+  catch _ =>
+    return none
+
+private def readImport (i : Import) (mFile? : Option System.FilePath := none) :
+    IO (ModuleData × CompactedRegion) := do
+  let mFile ← match mFile? with
+    | some mFile => pure mFile
+    | none       => findOLean i.module
+  unless (← mFile.pathExists) do
+    throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
+  readModuleData mFile
+
 partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
+  -- Read the direct imports in parallel, which in particular relocates them if they cannot be
+  -- `mmap`ed. They are still processed in order below so that the module order is deterministic.
+  -- Each module of the import closure is resolved and prefetched exactly once, here.
+  for i in imports do
+    let s ← get
+    unless i.runtimeOnly || s.moduleNameSet.contains i.module || s.pendingReads.contains i.module do
+      let mFile? ← prefetchImport i.module
+      let t ← IO.asTask (readImport i mFile?)
+      modify fun s => { s with pendingReads := s.pendingReads.insert i.module t }
   for i in imports do
     if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
       continue
     modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
-    let mFile ← findOLean i.module
-    unless (← mFile.pathExists) do
-      throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-    let (mod, region) ← readModuleData mFile
+    let pending? := (← get).pendingReads[i.module]?
+    modify fun s => { s with pendingReads := s.pendingReads.erase i.module }
+    let (mod, region) ← match pending? with
+      | some t => do
+        match (← IO.wait t) with
+        | .ok r    => pure r
+        | .error e => throw e
+      | none => readImport i
     importModulesCore mod.imports
     modify fun s => { s with
       moduleData  := s.moduleData.push mod
@@ -1772,6 +1915,25 @@ partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
       moduleNames := s.moduleNames.push i.module
     }
 
+/--
+Waits for the reads in `pendingReads` that have not been consumed, e.g. because an import failed,
+and frees their regions.
+-/
+unsafe def freePendingReads : ImportStateM Unit := do
+  let regions ← takePendingRegions
+  -- The tasks and their module data have been released at this point, so nothing refers to the
+  -- regions anymore.
+  for region in regions do
+    region.free
+where
+  takePendingRegions : ImportStateM (Array CompactedRegion) := do
+    let pending := (← get).pendingReads
+    modify fun s => { s with pendingReads := {} }
+    pending.foldM (init := #[]) fun regions _ t => do
+      match (← IO.wait t) with
+      | .ok (_, region) => return regions.push region
+      | .error _        => return regions
+
 /--
 Return `true` if `cinfo₁` and `cinfo₂` are theorems with the same name, universe parameters,
 and types. We allow different modules to prove the same theorem.
@@ -1810,6 +1972,10 @@ private def equivInfo (cinfo₁ cinfo₂ : ConstantInfo) : Bool := Id.run do
   as such). -/
 def finalizeImport (s : ImportState) (imports : Array Import) (opts : Options) (trustLevel : UInt32 := 0)
     (leakEnv := false) : IO Environment := do
+  for modName in s.moduleNames, region in s.regions do
+    unless (← region.hasValidExternalRefs) do
+      throw <| IO.userError s!"import {modName} failed, its .olean file references other .olean files that \
+        could not be loaded or have changed; rebuild it without LEAN_OLEAN_SHARE_IMPORTS=1"
   let numConsts := s.moduleData.foldl (init := 0) fun numConsts mod =>
     numConsts + mod.constants.size + mod.extraConstNames.size
   let mut const2ModIdx : Std.HashMap Name ModuleIdx := Std.HashMap.emptyWithCapacity (capacity := numConsts)
@@ -1883,7 +2049,12 @@ def importModules (imports : Array Import) (opts : Options) (trustLevel : UInt32
       throw <| IO.userError "import failed, trying to import module with anonymous name"
   withImporting do
     plugins.forM Lean.loadPlugin
-    let (_, s) ← importModulesCore imports |>.run
+    let (_, s) ← ImportStateM.run do
+      try
+        importModulesCore imports
+      catch e =>
+        unsafe freePendingReads
+        throw e
     finalizeImport (leakEnv := leakEnv) s imports opts trustLevel
 
 /--
@@ -1893,13 +2064,20 @@ unsafe def withImportModules {α : Type} (imports : Array Import) (opts : Option
   let env ← importModules imports opts trustLevel
   try act env finally env.freeRegions
 
+@[inherit_doc Kernel.Environment.setSharedCache]
+unsafe def Kernel.setSharedCache (env : Lean.Environment) (cache? : Option Kernel.SharedCache) : Lean.Environment :=
+  env.modifyCheckedAsync (·.setSharedCache cache?)
+
 @[inherit_doc Kernel.Environment.enableDiag]
-def Kernel.enableDiag (env : Lean.Environment) (flag : Bool) : Lean.Environment :=
-  env.modifyCheckedAsync (·.enableDiag flag)
+def Kernel.enableDiag (env : Lean.Environment) (flag : Bool) (stats := false) : Lean.Environment :=
+  env.modifyCheckedAsync (·.enableDiag flag stats)
 
 def Kernel.isDiagnosticsEnabled (env : Lean.Environment) : Bool :=
   env.base.isDiagnosticsEnabled
 
+def Kernel.isDiagnosticsStatsEnabled (env : Lean.Environment) : Bool :=
+  env.base.isDiagnosticsStatsEnabled
+
 def Kernel.resetDiag (env : Lean.Environment) : Lean.Environment :=
   env.modifyCheckedAsync (·.resetDiag)
 
@@ -69,6 +69,43 @@ def mkDiagSynthPendingFailure (failures : PHashMap Expr MessageData) : MetaM Dia
       data := data.push <| .trace { cls := `type_class } msg #[]
     return { data }
 
+private def fmtTime (ns : Nat) : String :=
+  let us := ns / 1000
+  s!"{us / 1000}.{(toString (us % 1000 + 1000)).drop 1}ms"
+
+private def fmtCache (calls hits : Nat) : String :=
+  let ratio := if calls == 0 then 0 else hits * 100 / calls
+  s!"{calls} calls, {hits} cache hits ({ratio}%)"
+
+/--
+Summary of `Kernel.Diagnostics.reductionStats`, for declarations for which the kernel performed more
+`whnf` and `whnfCore` steps than the threshold.
+-/
+def mkDiagSummaryForKernelStats (stats : PHashMap Name Kernel.ReductionStats) : MetaM DiagSummary := do
+  let threshold := diagnostics.threshold.get (← getOptions)
+  let steps (s : Kernel.ReductionStats) := s.whnfCalls + s.whnfCoreCalls
+  let mut entries := #[]
+  for (declName, s) in stats do
+    if steps s > threshold then
+      entries := entries.push (declName, s)
+  if entries.isEmpty then
+    return {}
+  let entries := entries.qsort fun (_, s₁) (_, s₂) => s₁.totalTime > s₂.totalTime
+  let mut data := #[]
+  for (declName, s) in entries do
+    let children : Array MessageData := #[
+      m!"whnf: {fmtCache s.whnfCalls s.whnfCacheHits}, {fmtTime s.whnfTime}",
+      m!"whnfCore: {fmtCache s.whnfCoreCalls s.whnfCoreCacheHits}, {fmtTime s.whnfCoreTime}",
+      m!"inferType: {fmtCache s.inferTypeCalls s.inferTypeCacheHits}",
+      m!"lazy delta reduction: {s.lazyDeltaSteps} steps, {s.failureCacheHits} failure cache hits, {fmtTime s.lazyDeltaTime}",
+      m!"Nat literal reduction: {s.natReductions} reductions, {fmtTime s.natReductionTime}",
+      m!"BitVec/UIntN/Fin literal reduction: {s.fixedWidthReductions} reductions",
+      m!"eta for structures: {s.etaStructSuccesses}/{s.etaStructChecks} succeeded",
+      m!"proof irrelevance: {s.proofIrrelSuccesses}/{s.proofIrrelChecks} succeeded"]
+    data := data.push <| .trace { cls := `kernel } m!"{declName} ↦ {fmtTime s.totalTime}"
+      (children.map fun m => .trace { cls := `kernel } m #[])
+  return { data, max := entries.foldl (init := 0) fun m (_, s) => max m (steps s) }
+
 /--
 We use below that this returns `m` unchanged if `s.isEmpty`
 -/
@@ -89,6 +126,10 @@ def reportDiag : MetaM Unit := do
     let inst ← mkDiagSummaryForUsedInstances
     let synthPending ← mkDiagSynthPendingFailure (← get).diag.synthPendingFailures
     let unfoldKernel ← mkDiagSummary `kernel (Kernel.getDiagnostics (← getEnv)).unfoldCounter
+    let kernelStats ← if diagnostics.kernelStats.get (← getOptions) then
+      mkDiagSummaryForKernelStats (Kernel.getDiagnostics (← getEnv)).reductionStats
+    else
+      pure {}
     let m := #[]
     let m := appendSection m `reduction "unfolded declarations" unfoldDefault
     let m := appendSection m `reduction "unfolded instances" unfoldInstance
@@ -99,6 +140,7 @@ def reportDiag : MetaM Unit := do
               synthPending (resultSummary := false)
     let m := appendSection m `def_eq "heuristic for solving `f a =?= f b`" heu
     let m := appendSection m `kernel "unfolded declarations" unfoldKernel
+    let m := appendSection m `kernel "reduction statistics (whnf and whnfCore steps)" kernelStats
     unless m.isEmpty do
       let m := m.push "use `set_option diagnostics.threshold <num>` to control threshold for reporting counters"
       logInfo <| .trace { cls := `diag, collapsed := false } "Diagnostics" m
@@ -22,6 +22,9 @@ after replaying any inductive definitions occurring in `constantMap`.
 * a verifier for an `Environment`, by sending everything to the kernel, or
 * a mechanism to safely transfer constants from one `Environment` to another.
 
+`replayParallel` produces the same environment, but type checks declarations concurrently,
+which is useful for re-verifying large libraries.
+
 -/
 
 namespace Lean.Environment
@@ -30,6 +33,8 @@ namespace Replay
 
 structure Context where
   newConstants : Std.HashMap Name ConstantInfo
+  /-- Whether to type check declarations on the task pool, see `addDecl`. -/
+  parallel : Bool := false
 
 structure State where
   env : Environment
@@ -37,6 +42,8 @@ structure State where
   pending : NameSet := {}
   postponedConstructors : NameSet := {}
   postponedRecursors : NameSet := {}
+  /-- The type checking of each added declaration in order, returning the time it took in nanoseconds. -/
+  checks : Array (Name × Task (Except IO.Error Nat)) := #[]
 
 abbrev M := ReaderT Context <| StateRefT State IO
 
@@ -53,11 +60,38 @@ def isTodo (name : Name) : M Bool := do
 def throwKernelException (ex : Kernel.Exception) : M Unit := do
   throw <| .userError <| (← ex.toMessageData {} |>.toString)
 
-/-- Add a declaration, possibly throwing a `Kernel.Exception`. -/
+/-- Type check `d` in `env`, returning the time it took in nanoseconds. -/
+def checkDecl (env : Environment) (d : Declaration) : IO Nat := do
+  let start ← IO.monoNanosNow
+  match env.addDeclCore 0 d (cancelTk? := none) with
+  | .ok _ => return (← IO.monoNanosNow) - start
+  | .error ex => throw <| .userError <| (← ex.toMessageData {} |>.toString)
+
+/--
+Add a declaration, possibly throwing a `Kernel.Exception`.
+
+In parallel mode, the declaration is added without type checking it, and the type checking is
+spawned on the task pool instead. As it uses the environment at this point, which contains exactly
+the declarations added before, the result is the same as if it had been added sequentially. The
+kernel always checks inductive types when adding them, so they are checked right away.
+-/
 def addDecl (d : Declaration) : M Unit := do
-  match (← get).env.addDeclCore 0 d (cancelTk? := none) with
-  | .ok env => modify fun s => { s with env := env }
-  | .error ex => throwKernelException ex
+  let name := match d.getTopLevelNames with
+    | n :: _ => n
+    | []     => .anonymous
+  let env := (← get).env
+  if (← read).parallel && !(d matches .inductDecl .. | .quotDecl) then
+    let t ← IO.asTask (checkDecl env d)
+    match env.addDeclCore 0 d (cancelTk? := none) (doCheck := false) with
+    | .ok env => modify fun s => { s with env, checks := s.checks.push (name, t) }
+    | .error ex => throwKernelException ex
+  else
+    let start ← IO.monoNanosNow
+    match env.addDeclCore 0 d (cancelTk? := none) with
+    | .ok env =>
+      let time := (← IO.monoNanosNow) - start
+      modify fun s => { s with env, checks := s.checks.push (name, .pure (.ok time)) }
+    | .error ex => throwKernelException ex
 
 mutual
 /--
@@ -147,23 +181,79 @@ end Replay
 
 open Replay
 
+/--
+Attaches a new shared kernel cache with about `size` entries to `env` if `size` is positive, see
+`Kernel.Environment.sharedCache?`. The declarations added by a replay form a single chain of
+environments, so the cache is sound as long as it is detached again by `detachSharedCache` before the
+resulting environment is returned.
+-/
+private def attachSharedCache (env : Environment) (size : Nat) : IO Environment := do
+  if size == 0 then
+    return env
+  let cache ← Kernel.SharedCache.new size.toUSize
+  return unsafe Kernel.setSharedCache env (some cache)
+
+private def detachSharedCache (env : Environment) (size : Nat) : Environment :=
+  if size == 0 then env else unsafe Kernel.setSharedCache env none
+
 /--
 "Replay" some constants into an `Environment`, sending them to the kernel for checking.
 
+If `sharedCacheSize` is positive, the kernel shares up to about that many reduction and type inference
+results between the checks of different declarations during this call.
+
 Throws a `IO.userError` if the kernel rejects a constant,
 or if there are malformed recursors or constructors for inductive types.
 -/
-def replay (newConstants : Std.HashMap Name ConstantInfo) (env : Environment) : IO Environment := do
+def replay (newConstants : Std.HashMap Name ConstantInfo) (env : Environment) (sharedCacheSize := 0) :
+    IO Environment := do
   let mut remaining : NameSet := ∅
   for (n, ci) in newConstants.toList do
     -- We skip unsafe constants, and also partial constants.
     -- Later we may want to handle partial constants.
     if !ci.isUnsafe && !ci.isPartial then
       remaining := remaining.insert n
+  let env ← attachSharedCache env sharedCacheSize
   let (_, s) ← StateRefT'.run (s := { env, remaining }) do
     ReaderT.run (r := { newConstants }) do
       for n in remaining do
         replayConstant n
       checkPostponedConstructors
       checkPostponedRecursors
-  return s.env
+  return detachSharedCache s.env sharedCacheSize
+
+/--
+Like `replay`, but type checks the declarations concurrently on the task pool. Each declaration is
+still checked in an environment containing exactly the declarations replayed before it, so the
+result is the same. Also returns the time in nanoseconds it took to check each declaration, in the
+order they were replayed.
+
+Throws the error of the first rejected declaration in that order. Declarations that are checked
+synchronously, such as inductive types, and the checks of constructors and recursors may fail before
+the checks of previously replayed declarations have finished, so these are awaited first.
+-/
+def replayParallel (newConstants : Std.HashMap Name ConstantInfo) (env : Environment) (sharedCacheSize := 0) :
+    IO (Environment × Array (Name × Nat)) := do
+  let mut remaining : NameSet := ∅
+  for (n, ci) in newConstants.toList do
+    if !ci.isUnsafe && !ci.isPartial then
+      remaining := remaining.insert n
+  let env ← attachSharedCache env sharedCacheSize
+  let (_, s) ← StateRefT'.run (s := { env, remaining }) do
+    ReaderT.run (r := { newConstants, parallel := true }) do
+      try
+        for n in remaining do
+          replayConstant n
+        checkPostponedConstructors
+        checkPostponedRecursors
+      catch e =>
+        for (_, t) in (← get).checks do
+          if let .error e' ← IO.wait t then
+            throw e'
+        throw e
+  let mut times := #[]
+  for (n, t) in s.checks do
+    match (← IO.wait t) with
+    | .ok time => times := times.push (n, time)
+    | .error e => throw e
+  return (detachSharedCache s.env sharedCacheSize, times)
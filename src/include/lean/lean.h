@@ -124,12 +124,21 @@ These two fields together have 48-bits, and this is enough for modern computers.
 In 32-bit machines, the field `m_rc` is sufficient.
 
 The field `m_other` is used to store the number of fields in a constructor object and the element size in a scalar array.
+
+When the runtime is built with `LEAN_BIASED_RC`, multi threaded objects use biased reference counting: the thread that
+marked the object as multi threaded (`m_owner`) keeps updating `m_rc` non-atomically, and all other threads use
+the atomic counter `m_shared_rc`. The two counters are merged when the owner drops its last reference.
+See `lean_mark_mt` in `object.cpp`. The fields are only meaningful for multi threaded objects.
 */
 typedef struct {
     int      m_rc;
     unsigned m_cs_sz:16;
     unsigned m_other:8;
     unsigned m_tag:8;
+#ifdef LEAN_BIASED_RC
+    unsigned m_owner;
+    int      m_shared_rc;
+#endif
 } lean_object;
 
 /*
@@ -213,6 +222,7 @@ typedef struct {
 } lean_thunk_object;
 
 struct lean_task;
+struct lean_task_waiter;
 
 /* Data required for executing a Lean task. It is released as soon as
    the task terminates even if the task object itself is still referenced. */
@@ -220,6 +230,10 @@ typedef struct {
     lean_object *        m_closure;
     struct lean_task *   m_head_dep;
     struct lean_task *   m_next_dep;
+    /* Threads blocked on this task, woken when it finishes */
+    struct lean_task_waiter * m_waiters;
+    /* Time the task was last queued in nanoseconds, or 0, for task manager statistics */
+    uint64_t             m_queue_time;
     unsigned             m_prio;
     uint8_t              m_canceled;
     // If true, task will not be freed until finished
@@ -240,7 +254,7 @@ typedef struct {
 
    states:
    * Queued
-     * condition: in task_manager::m_queues && m_imp != nullptr && !m_imp->m_deleted
+     * condition: in a task_manager run queue && m_imp != nullptr && !m_imp->m_deleted
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
      * transition: dequeued by worker thread            ==> Running     (`spawn_worker` lock)
@@ -336,6 +350,10 @@ LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx);
 LEAN_EXPORT void lean_free_small(void * p);
 LEAN_EXPORT unsigned lean_small_mem_size(void * p);
 LEAN_EXPORT void lean_inc_heartbeat(void);
+/* Allocation statistics for when the small object allocator is disabled and `LEAN_ALLOC_STATS` is
+   set, see `get_alloc_stats` */
+LEAN_EXPORT void lean_small_object_allocated(unsigned sz);
+LEAN_EXPORT void lean_small_object_freed(unsigned sz);
 
 #ifndef __cplusplus
 void * malloc(size_t);  // avoid including big `stdlib.h`
@@ -347,8 +365,12 @@ static inline lean_object * lean_alloc_small_object(unsigned sz) {
     unsigned slot_idx = lean_get_slot_idx(sz);
     assert(sz <= LEAN_MAX_SMALL_OBJECT_SIZE);
     return (lean_object*)lean_alloc_small(sz, slot_idx);
+#else
+#ifdef LEAN_ALLOC_STATS
+    lean_small_object_allocated(sz);
 #else
     lean_inc_heartbeat();
+#endif
 #ifdef LEAN_MIMALLOC
     // HACK: emulate behavior of small allocator to avoid `leangz` breakage for now
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
@@ -421,9 +443,15 @@ static inline void lean_free_small_object(lean_object * o) {
 #ifdef LEAN_SMALL_ALLOCATOR
     lean_free_small(o);
 #elif defined(LEAN_MIMALLOC)
+#ifdef LEAN_ALLOC_STATS
+    lean_small_object_freed(o->m_cs_sz);
+#endif
     mi_free_size((void *)o, o->m_cs_sz);
 #else
     size_t* ptr = (size_t*)o - 1;
+#ifdef LEAN_ALLOC_STATS
+    lean_small_object_freed(*ptr);
+#endif
     free_sized(ptr, *ptr + sizeof(size_t));
 #endif
 }
@@ -1173,6 +1201,9 @@ LEAN_EXPORT void lean_finalize_task_manager(void);
 LEAN_EXPORT lean_obj_res lean_task_spawn_core(lean_obj_arg c, unsigned prio, bool keep_alive);
 /* Run a closure `Unit -> A` as a `Task A` */
 static inline lean_obj_res lean_task_spawn(lean_obj_arg c, lean_obj_arg prio) { return lean_task_spawn_core(c, lean_unbox(prio), false); }
+LEAN_EXPORT lean_obj_res lean_task_spawn_many_core(lean_obj_arg cs, unsigned prio, bool keep_alive);
+/* Task.spawnMany (cs : Array (Unit -> A)) (prio : Nat) : Array (Task A) */
+static inline lean_obj_res lean_task_spawn_many(lean_obj_arg cs, lean_obj_arg prio) { return lean_task_spawn_many_core(cs, lean_unbox(prio), false); }
 /* Convert a value `a : A` into `Task A` */
 LEAN_EXPORT lean_obj_res lean_task_pure(lean_obj_arg a);
 LEAN_EXPORT lean_obj_res lean_task_bind_core(lean_obj_arg x, lean_obj_arg f, unsigned prio, bool sync, bool keep_alive);
@@ -26,16 +26,38 @@ extern "C" object* lean_kernel_record_unfold (object*, object*);
 extern "C" object* lean_kernel_get_diag(object*);
 extern "C" object* lean_kernel_set_diag(object*, object*);
 extern "C" uint8* lean_kernel_diag_is_enabled(object*);
+extern "C" uint8 lean_kernel_diag_stats_enabled(object*);
+extern "C" object* lean_kernel_get_shared_cache(object*);
+extern "C" object* lean_kernel_record_stats(object*, object*, object*);
 
 void diagnostics::record_unfold(name const & decl_name) {
     m_obj = lean_kernel_record_unfold(to_obj_arg(), decl_name.to_obj_arg());
 }
 
+// must be updated together with `Kernel.ReductionStats`, see also `tests/lean/run/kernelReductionStats.lean`
+static_assert(reduction_stats::NumCounters + reduction_stats::NumTimers == 19, "unexpected number of reduction statistics");
+
+void diagnostics::record_stats(name const & decl_name) {
+    // `Kernel.ReductionStats` only has `Nat` fields, the counters followed by the timers
+    object * s = alloc_cnstr(0, reduction_stats::NumCounters + reduction_stats::NumTimers, 0);
+    unsigned i = 0;
+    for (uint64 c : m_stats.m_counters)
+        cnstr_set(s, i++, lean_uint64_to_nat(c));
+    for (uint64 t : m_stats.m_times)
+        cnstr_set(s, i++, lean_uint64_to_nat(t));
+    m_obj = lean_kernel_record_stats(to_obj_arg(), decl_name.to_obj_arg(), s);
+    m_stats = reduction_stats();
+}
+
 scoped_diagnostics::scoped_diagnostics(environment const & env, bool collect) {
     if (collect) {
         diagnostics d(env.get_diag());
         if (lean_kernel_diag_is_enabled(d.to_obj_arg())) {
             m_diag = new diagnostics(d);
+            if (lean_kernel_diag_stats_enabled(d.to_obj_arg())) {
+                m_diag->set_collect_stats(true);
+                m_start = std::chrono::steady_clock::now();
+            }
         } else
             m_diag = nullptr;
     } else {
@@ -48,10 +70,15 @@ scoped_diagnostics::~scoped_diagnostics() {
         delete m_diag;
 }
 
-environment scoped_diagnostics::update(environment const & env) const {
-    if (m_diag)
+environment scoped_diagnostics::update(environment const & env, name const & decl_name) {
+    if (m_diag) {
+        if (reduction_stats * stats = m_diag->stats()) {
+            stats->m_times[reduction_stats::TotalTime] =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+            m_diag->record_stats(decl_name);
+        }
         return env.set_diag(*m_diag);
-    else
+    } else
         return env;
 }
 
@@ -63,6 +90,15 @@ environment environment::set_diag(diagnostics const & diag) const {
     return environment(lean_kernel_set_diag(to_obj_arg(), diag.to_obj_arg()));
 }
 
+shared_cache * environment::get_shared_cache() const {
+    object * o = lean_kernel_get_shared_cache(to_obj_arg());
+    if (is_scalar(o))
+        return nullptr;
+    shared_cache * r = static_cast<shared_cache *>(lean_get_external_data(cnstr_get(o, 0)));
+    dec(o);
+    return r;
+}
+
 bool environment::is_quot_initialized() const {
     return lean_environment_quot_init(to_obj_arg()) != 0;
 }
@@ -154,7 +190,7 @@ environment environment::add_axiom(declaration const & d, bool check) const {
     axiom_val const & v = d.to_axiom_val();
     if (check)
         check_constant_val(*this, v.to_constant_val(), diag.get(), !d.is_unsafe());
-    return diag.update(add(constant_info(d)));
+    return diag.update(add(constant_info(d)), v.get_name());
 }
 
 environment environment::add_definition(declaration const & d, bool check) const {
@@ -175,7 +211,7 @@ environment environment::add_definition(declaration const & d, bool check) const
             if (!checker.is_def_eq(val_type, v.get_type()))
                 throw definition_type_mismatch_exception(new_env, d, val_type);
         }
-        return diag.update(new_env);
+        return diag.update(new_env, v.get_name());
     } else {
         if (check) {
             type_checker checker(*this, diag.get());
@@ -185,7 +221,7 @@ environment environment::add_definition(declaration const & d, bool check) const
             if (!checker.is_def_eq(val_type, v.get_type()))
                 throw definition_type_mismatch_exception(*this, d, val_type);
         }
-        return diag.update(add(constant_info(d)));
+        return diag.update(add(constant_info(d)), v.get_name());
     }
 }
 
@@ -205,7 +241,7 @@ environment environment::add_theorem(declaration const & d, bool check) const {
         if (!checker.is_def_eq(val_type, type))
             throw definition_type_mismatch_exception(*this, d, val_type);
     }
-    return diag.update(add(constant_info(d)));
+    return diag.update(add(constant_info(d)), v.get_name());
 }
 
 environment environment::add_opaque(declaration const & d, bool check) const {
@@ -218,7 +254,7 @@ environment environment::add_opaque(declaration const & d, bool check) const {
         if (!checker.is_def_eq(val_type, v.get_type()))
             throw definition_type_mismatch_exception(*this, d, val_type);
     }
-    return diag.update(add(constant_info(d)));
+    return diag.update(add(constant_info(d)), v.get_name());
 }
 
 environment environment::add_mutual(declaration const & d, bool check) const {
@@ -253,7 +289,7 @@ environment environment::add_mutual(declaration const & d, bool check) const {
                 throw definition_type_mismatch_exception(new_env, d, val_type);
         }
     }
-    return diag.update(new_env);
+    return diag.update(new_env, head(vs).get_name());
 }
 
 environment environment::add(declaration const & d, bool check) const {
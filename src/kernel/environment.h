@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <utility>
 #include <memory>
 #include <vector>
+#include <chrono>
 #include "runtime/optional.h"
 #include "util/rc.h"
 #include "util/list.h"
@@ -25,8 +26,45 @@ Author: Leonardo de Moura
 
 namespace lean {
 
+/* Counters and timers for the main reduction paths of the type checker, collected while checking a declaration
+   when kernel diagnostics are enabled. The order of the entries must match the fields of `Kernel.ReductionStats`. */
+/* The counters followed by the timers must be in the same order as the fields of `Kernel.ReductionStats`,
+   see `diagnostics::record_stats`. */
+struct reduction_stats {
+    enum counter {
+        WhnfCore, WhnfCoreCacheHit, Whnf, WhnfCacheHit, InferType, InferTypeCacheHit,
+        LazyDeltaStep, FailureCacheHit, NatReduction, FixedWidthReduction, EtaStruct, EtaStructSuccess, ProofIrrel, ProofIrrelSuccess,
+        NumCounters
+    };
+    /* Times are in nanoseconds. Recursive activations of a path are only timed once, at the outermost one. */
+    enum timer { WhnfCoreTime, WhnfTime, LazyDeltaTime, NatReductionTime, TotalTime, NumTimers };
+    uint64   m_counters[NumCounters] = {};
+    uint64   m_times[NumTimers] = {};
+    unsigned m_depth[NumTimers] = {};
+};
+
+/* Add the time spent in the outermost activation of `t` to `stats`, unless `stats` is `nullptr`. */
+class scoped_reduction_timer {
+    reduction_stats *                     m_stats;
+    reduction_stats::timer                m_timer;
+    std::chrono::steady_clock::time_point m_start;
+public:
+    scoped_reduction_timer(reduction_stats * stats, reduction_stats::timer t):m_stats(stats), m_timer(t) {
+        if (m_stats && m_stats->m_depth[m_timer]++ == 0)
+            m_start = std::chrono::steady_clock::now();
+    }
+    scoped_reduction_timer(scoped_reduction_timer const &) = delete;
+    ~scoped_reduction_timer() {
+        if (m_stats && --m_stats->m_depth[m_timer] == 0)
+            m_stats->m_times[m_timer] +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+    }
+};
+
 /* Wrapper for `Kernel.Diagnostics` */
 class diagnostics : public object_ref {
+    reduction_stats m_stats;
+    bool            m_collect_stats = false;
 public:
     diagnostics(diagnostics const & other):object_ref(other) {}
     diagnostics(diagnostics && other):object_ref(other) {}
@@ -34,6 +72,11 @@ public:
     explicit diagnostics(obj_arg o):object_ref(o) {}
     ~diagnostics() {}
     void record_unfold(name const & decl_name);
+    void set_collect_stats(bool flag) { m_collect_stats = flag; }
+    /* `nullptr` unless reduction statistics are collected, see `Kernel.Diagnostics.collectStats`. */
+    reduction_stats * stats() { return m_collect_stats ? &m_stats : nullptr; }
+    /* Store the statistics collected so far as the ones of `decl_name`, and reset them. */
+    void record_stats(name const & decl_name);
 };
 
 /*
@@ -46,15 +89,19 @@ that was not requested.
 */
 class scoped_diagnostics {
     diagnostics * m_diag;
+    std::chrono::steady_clock::time_point m_start;
 public:
     scoped_diagnostics(environment const & env, bool collect);
     scoped_diagnostics(scoped_diagnostics const &) = delete;
     scoped_diagnostics(scoped_diagnostics &&) = delete;
     ~scoped_diagnostics();
-    environment update(environment const &) const;
+    /* Store the collected diagnostics in the given environment, with the reduction statistics attributed to `decl_name`. */
+    environment update(environment const &, name const & decl_name);
     diagnostics * get() const { return m_diag; }
 };
 
+class shared_cache;
+
 /* Wrapper for `Lean.Kernel.Environment` */
 class LEAN_EXPORT environment : public object_ref {
     friend class add_inductive_fn;
@@ -85,6 +132,10 @@ public:
     diagnostics get_diag() const;
     environment set_diag(diagnostics const & diag) const;
 
+    /** \brief Return the cache attached to this environment (see `Kernel.Environment.sharedCache?`), if any.
+        It lives at least as long as the environment. */
+    shared_cache * get_shared_cache() const;
+
     bool is_quot_initialized() const;
 
     /** \brief Return information for the constant with name \c n (if it is defined in this environment). */
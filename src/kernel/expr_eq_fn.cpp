@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include "runtime/interrupt.h"
 #include "runtime/thread.h"
 #include "kernel/expr.h"
+#include "util/flat_hash_map.h"
 #include "kernel/expr_sets.h"
 
 namespace lean {
@@ -26,7 +27,7 @@ class expr_eq_fn {
             return hash((size_t)p.first >> 3, (size_t)p.second >> 3);
         }
     };
-    typedef std::unordered_set<std::pair<lean_object *, lean_object *>, key_hasher> cache;
+    typedef flat_hash_set<std::pair<lean_object *, lean_object *>, key_hasher, 16> cache;
     cache * m_cache = nullptr;
     size_t m_max_stack_depth = 0;
     size_t m_counter = 0;
@@ -35,11 +36,7 @@ class expr_eq_fn {
             return false;
         if (!m_cache)
             m_cache = new cache();
-        std::pair<lean_object *, lean_object *> key(a.raw(), b.raw());
-        if (m_cache->find(key) != m_cache->end())
-            return true;
-        m_cache->insert(key);
-        return false;
+        return !m_cache->insert(std::pair<lean_object *, lean_object *>(a.raw(), b.raw()));
     }
     void check_system(unsigned depth) {
         /*
@@ -1115,9 +1115,10 @@ environment environment::add_inductive(declaration const & d) const {
     unsigned nnested = res.m_aux2nested.size();
     scoped_diagnostics diag(*this, true);
     environment aux_env = add_inductive_fn(*this, diag.get(), inductive_decl(res.m_aux_decl), nnested)();
+    name main_name = head(inductive_decl(d).get_types()).get_name();
     if (!nnested) {
         /* `d` did not contain nested inductive types. */
-        return diag.update(aux_env);
+        return diag.update(aux_env, main_name);
     } else {
         /* Restore nested inductives. */
         inductive_decl ind_d(d);
@@ -1172,7 +1173,7 @@ environment environment::add_inductive(declaration const & d) const {
         for (name const & aux_rec : aux_rec_names) {
             process_rec(aux_rec);
         }
-        return diag.update(new_env);
+        return diag.update(new_env, main_name);
     }
 }
 
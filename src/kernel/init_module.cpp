@@ -14,6 +14,7 @@ Author: Leonardo de Moura
 #include "kernel/inductive.h"
 #include "kernel/quot.h"
 #include "kernel/trace.h"
+#include "kernel/shared_cache.h"
 
 namespace lean {
 void initialize_kernel_module() {
@@ -26,9 +27,11 @@ void initialize_kernel_module() {
     initialize_inductive();
     initialize_quot();
     initialize_trace();
+    initialize_shared_cache();
 }
 
 void finalize_kernel_module() {
+    finalize_shared_cache();
     finalize_trace();
     finalize_quot();
     finalize_inductive();
@@ -5,8 +5,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Authors: Leonardo de Moura
 */
 #include <vector>
-#include <unordered_map>
 #include "util/name_set.h"
+#include "util/flat_hash_map.h"
 #include "runtime/option_ref.h"
 #include "runtime/array_ref.h"
 #include "kernel/instantiate.h"
@@ -33,12 +33,12 @@ option_ref<level> get_lmvar_assignment(metavar_ctx & mctx, name const & mid) {
 
 class instantiate_lmvars_fn {
     metavar_ctx & m_mctx;
-    std::unordered_map<lean_object *, level> m_cache;
+    flat_hash_map<lean_object *, level, ptr_hash> m_cache;
     std::vector<level> m_saved; // Helper vector to prevent values from being garbage collected
 
     inline level cache(level const & l, level r, bool shared) {
         if (shared) {
-            m_cache.insert(mk_pair(l.raw(), r));
+            m_cache.insert(l.raw(), r);
         }
         return r;
     }
@@ -49,9 +49,8 @@ public:
             return l;
         bool shared = false;
         if (is_shared(l)) {
-            auto it = m_cache.find(l.raw());
-            if (it != m_cache.end()) {
-                return it->second;
+            if (level * r = m_cache.find(l.raw())) {
+                return *r;
             }
             shared = true;
         }
@@ -141,7 +140,7 @@ class instantiate_mvars_fn {
     metavar_ctx & m_mctx;
     instantiate_lmvars_fn m_level_fn;
     name_set m_already_normalized; // Store metavariables whose assignment has already been normalized.
-    std::unordered_map<lean_object *, expr> m_cache;
+    flat_hash_map<lean_object *, expr, ptr_hash> m_cache;
     std::vector<expr> m_saved; // Helper vector to prevent values from being garbage collected
 
     level visit_level(level const & l) {
@@ -157,7 +156,7 @@ class instantiate_mvars_fn {
 
     inline expr cache(expr const & e, expr r, bool shared) {
         if (shared) {
-            m_cache.insert(mk_pair(e.raw(), r));
+            m_cache.insert(e.raw(), r);
         }
         return r;
     }
@@ -329,9 +328,8 @@ public:
             return e;
         bool shared = false;
         if (is_shared(e)) {
-            auto it = m_cache.find(e.raw());
-            if (it != m_cache.end()) {
-                return it->second;
+            if (expr * r = m_cache.find(e.raw())) {
+                return *r;
             }
             shared = true;
         }
@@ -7,7 +7,7 @@ Author: Leonardo de Moura
 #include <vector>
 #include <memory>
 #include <utility>
-#include <unordered_map>
+#include "util/flat_hash_map.h"
 #include "kernel/replace_fn.h"
 
 namespace lean {
@@ -18,22 +18,21 @@ class replace_rec_fn {
             return hash((size_t)p.first >> 3, p.second);
         }
     };
-    std::unordered_map<std::pair<lean_object *, unsigned>, expr, key_hasher> m_cache;
+    flat_hash_map<std::pair<lean_object *, unsigned>, expr, key_hasher> m_cache;
     std::function<optional<expr>(expr const &, unsigned)> m_f;
     bool                                                  m_use_cache;
 
     expr save_result(expr const & e, unsigned offset, expr r, bool shared) {
         if (shared)
-            m_cache.insert(mk_pair(mk_pair(e.raw(), offset), r));
+            m_cache.insert(mk_pair(e.raw(), offset), r);
         return r;
     }
 
     expr apply(expr const & e, unsigned offset) {
         bool shared = false;
         if (m_use_cache && !is_likely_unshared(e)) {
-            auto it = m_cache.find(mk_pair(e.raw(), offset));
-            if (it != m_cache.end())
-                return it->second;
+            if (expr * r = m_cache.find(mk_pair(e.raw(), offset)))
+                return *r;
             shared = true;
         }
         if (optional<expr> r = m_f(e, offset)) {
@@ -84,21 +83,20 @@ expr replace(expr const & e, std::function<optional<expr>(expr const &, unsigned
 }
 
 class replace_fn {
-    std::unordered_map<lean_object *, expr> m_cache;
+    flat_hash_map<lean_object *, expr, ptr_hash> m_cache;
     lean_object * m_f;
 
     expr save_result(expr const & e, expr const & r, bool shared) {
         if (shared)
-            m_cache.insert(mk_pair(e.raw(), r));
+            m_cache.insert(e.raw(), r);
         return r;
     }
 
     expr apply(expr const & e) {
         bool shared = false;
         if (is_shared(e)) {
-            auto it = m_cache.find(e.raw());
-            if (it != m_cache.end())
-                return it->second;
+            if (expr * r = m_cache.find(e.raw()))
+                return *r;
             shared = true;
         }
 
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2025 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <algorithm>
+#include "runtime/io.h"
+#include "kernel/shared_cache.h"
+
+namespace lean {
+#define LEAN_SHARED_CACHE_LOG_SHARDS 6
+
+shared_cache::shared_cache(size_t max_entries):
+    // two generations per shard
+    m_max_gen_size(std::max(max_entries >> (LEAN_SHARED_CACHE_LOG_SHARDS + 1), static_cast<size_t>(1))),
+    m_shards(static_cast<size_t>(1) << LEAN_SHARED_CACHE_LOG_SHARDS) {
+}
+
+shared_cache::shard & shared_cache::get_shard(expr const & e) {
+    // use the upper bits, the lower ones select the bucket inside the shard
+    return m_shards[(hash(e) * 2654435761u) >> (32 - LEAN_SHARED_CACHE_LOG_SHARDS)];
+}
+
+/* `s.m_mutex` must be locked. */
+void shared_cache::insert_core(shard & s, kind k, expr const & e, expr const & r) {
+    if (s.m_gens[s.m_curr].m_size >= m_max_gen_size) {
+        s.m_curr = 1 - s.m_curr;
+        generation & g = s.m_gens[s.m_curr];
+        for (expr_map<expr> & m : g.m_maps)
+            m.clear();
+        g.m_size = 0;
+    }
+    generation & g = s.m_gens[s.m_curr];
+    if (g.m_maps[static_cast<unsigned>(k)].insert(mk_pair(e, r)).second)
+        g.m_size++;
+}
+
+optional<expr> shared_cache::find(kind k, expr const & e) {
+    shard & s = get_shard(e);
+    lock_guard<mutex> lock(s.m_mutex);
+    expr_map<expr> const & m = s.m_gens[s.m_curr].m_maps[static_cast<unsigned>(k)];
+    auto it = m.find(e);
+    if (it != m.end())
+        return some_expr(it->second);
+    expr_map<expr> const & old = s.m_gens[1 - s.m_curr].m_maps[static_cast<unsigned>(k)];
+    it = old.find(e);
+    if (it == old.end())
+        return none_expr();
+    // copy before `insert_core` may clear the old generation
+    expr key = it->first;
+    expr r   = it->second;
+    insert_core(s, k, key, r);
+    return some_expr(r);
+}
+
+void shared_cache::insert(kind k, expr const & e, expr const & r) {
+    // other threads may access them from now on
+    mark_mt(e.raw());
+    mark_mt(r.raw());
+    shard & s = get_shard(e);
+    lock_guard<mutex> lock(s.m_mutex);
+    insert_core(s, k, e, r);
+}
+
+static lean_external_class * g_shared_cache_external_class = nullptr;
+static void shared_cache_finalizer(void * c) {
+    delete static_cast<shared_cache *>(c);
+}
+static void shared_cache_foreach(void *, b_obj_arg) {}
+
+/* SharedCache.new (maxEntries : USize) : BaseIO SharedCache */
+extern "C" LEAN_EXPORT obj_res lean_kernel_mk_shared_cache(size_t max_entries, obj_arg) {
+    return io_result_mk_ok(lean_alloc_external(g_shared_cache_external_class, new shared_cache(max_entries)));
+}
+
+void initialize_shared_cache() {
+    g_shared_cache_external_class = lean_register_external_class(shared_cache_finalizer, shared_cache_foreach);
+}
+
+void finalize_shared_cache() {
+}
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2025 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <vector>
+#include "runtime/thread.h"
+#include "kernel/expr_maps.h"
+
+namespace lean {
+/** \brief Cache of type checker results that is shared by all type checkers whose environment it is attached
+    to (see `Kernel.Environment.sharedCache?`), including concurrent ones.
+
+    Only terms without free variables are cached. The weak head normal form or inferred type of such a term
+    depends only on the declarations it (transitively) refers to, so the result can be reused by any type
+    checker whose environment contains the same declarations. This is not checked: results are keyed by the
+    term alone, so the cache must only be attached to a single chain of environments, which is what
+    `Environment.replay` does. Types are only shared for `infer_only` mode, as checking a term also checks
+    that the declarations it refers to are in the environment. The cache is not used while collecting kernel
+    diagnostics, see `type_checker::type_checker`.
+
+    The cache is split into shards with separate locks. Each shard keeps two generations of entries: when
+    the current one is full, it becomes the old one, replacing the previous old one. Entries found in the old
+    generation are moved to the current one, so recently used entries survive. */
+class shared_cache {
+public:
+    enum class kind { WhnfCore, Whnf, InferOnly };
+private:
+    struct generation {
+        expr_map<expr> m_maps[3];
+        size_t         m_size = 0;
+    };
+    struct shard {
+        mutex          m_mutex;
+        generation     m_gens[2];
+        unsigned       m_curr = 0;
+    };
+    size_t             m_max_gen_size;
+    std::vector<shard> m_shards;
+    shard & get_shard(expr const & e);
+    void insert_core(shard & s, kind k, expr const & e, expr const & r);
+public:
+    explicit shared_cache(size_t max_entries);
+    static bool is_cacheable(expr const & e) { return !has_fvar(e) && !has_mvar(e); }
+    optional<expr> find(kind k, expr const & e);
+    void insert(kind k, expr const & e, expr const & r);
+};
+
+void initialize_shared_cache();
+void finalize_shared_cache();
+}
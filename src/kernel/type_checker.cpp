@@ -6,10 +6,12 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <bitset>
 #include "runtime/interrupt.h"
 #include "runtime/sstream.h"
 #include "runtime/flet.h"
 #include "util/lbool.h"
+#include "util/name_hash_map.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
@@ -40,6 +42,12 @@ static expr * g_nat_lor      = nullptr;
 static expr * g_nat_xor      = nullptr;
 static expr * g_nat_shiftLeft  = nullptr;
 static expr * g_nat_shiftRight = nullptr;
+static expr * g_nat_lt         = nullptr;
+static expr * g_nat_dec_lt     = nullptr;
+static expr * g_of_decide_eq_true = nullptr;
+static expr * g_bool_true_refl = nullptr;
+static expr * g_fin_mk         = nullptr;
+static expr * g_bitvec_of_fin  = nullptr;
 
 type_checker::state::state(environment const & env):
     m_env(env), m_ngen(*g_kernel_fresh) {}
@@ -294,9 +302,21 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     lean_assert(!has_loose_bvars(e));
     check_system("type checker", /* do_check_interrupted */ true);
 
+    count(reduction_stats::InferType);
     auto it = m_st->m_infer_type[infer_only].find(e);
-    if (it != m_st->m_infer_type[infer_only].end())
+    if (it != m_st->m_infer_type[infer_only].end()) {
+        count(reduction_stats::InferTypeCacheHit);
         return it->second;
+    }
+
+    bool share = infer_only && m_shared_cache && shared_cache::is_cacheable(e);
+    if (share) {
+        if (optional<expr> r = m_shared_cache->find(shared_cache::kind::InferOnly, e)) {
+            count(reduction_stats::InferTypeCacheHit);
+            m_st->m_infer_type[infer_only].insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
 
     expr r;
     switch (e.kind()) {
@@ -319,6 +339,8 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     }
 
     m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    if (share)
+        m_shared_cache->insert(shared_cache::kind::InferOnly, e, r);
     return r;
 }
 
@@ -441,11 +463,24 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     }
 
     // check cache
+    count(reduction_stats::WhnfCore);
     auto it = m_st->m_whnf_core.find(e);
-    if (it != m_st->m_whnf_core.end())
+    if (it != m_st->m_whnf_core.end()) {
+        count(reduction_stats::WhnfCoreCacheHit);
         return it->second;
+    }
+
+    bool share = !cheap_rec && !cheap_proj && m_shared_cache && shared_cache::is_cacheable(e);
+    if (share) {
+        if (optional<expr> r = m_shared_cache->find(shared_cache::kind::WhnfCore, e)) {
+            count(reduction_stats::WhnfCoreCacheHit);
+            m_st->m_whnf_core.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
 
     // do the actual work
+    scoped_reduction_timer timer(m_stats, reduction_stats::WhnfCoreTime);
     expr r;
     switch (e.kind()) {
     case expr_kind::BVar:  case expr_kind::Sort:  case expr_kind::MVar:
@@ -500,6 +535,8 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     if (!cheap_rec && !cheap_proj) {
         m_st->m_whnf_core.insert(mk_pair(e, r));
     }
+    if (share)
+        m_shared_cache->insert(shared_cache::kind::WhnfCore, e, r);
     return r;
 }
 
@@ -617,7 +654,7 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const &
     return f(v1.raw(), v2.raw()) ? some_expr(mk_bool_true()) : some_expr(mk_bool_false());
 }
 
-optional<expr> type_checker::reduce_nat(expr const & e) {
+optional<expr> type_checker::reduce_nat_core(expr const & e) {
     unsigned nargs = get_app_num_args(e);
     if (nargs == 1) {
         expr const & f = app_fn(e);
@@ -648,6 +685,314 @@ optional<expr> type_checker::reduce_nat(expr const & e) {
     return none_expr();
 }
 
+optional<expr> type_checker::reduce_nat(expr const & e) {
+    if (!m_stats)
+        return reduce_nat_core(e);
+    scoped_reduction_timer timer(m_stats, reduction_stats::NatReductionTime);
+    optional<expr> r = reduce_nat_core(e);
+    if (r)
+        count(reduction_stats::NatReduction);
+    return r;
+}
+
+/* Operations on `BitVec w`, `UIntN` and `Fin n` that the kernel evaluates on literals using GMP. Unlike the `Nat`
+   operations above, these are not trusted by name: `reduce_fixed_width` only uses an operation after
+   `check_fixed_width_op` has checked that its type and definition in the environment agree with the evaluation
+   below. */
+enum class fixed_width_kind { BitVec, UInt, Fin };
+enum class fixed_width_fn { OfNat, ToNat, Add, Sub, Mul, Neg, Div, Mod, And, Or, Xor, ShiftLeft, ShiftRight };
+
+struct fixed_width_op {
+    fixed_width_kind m_kind;
+    fixed_width_fn   m_fn;
+    unsigned         m_nargs;
+    // Width of `UIntN`, and its constructor `UIntN.ofBitVec`
+    unsigned         m_width;
+    expr             m_uint_mk;
+};
+
+static name_hash_map<fixed_width_op> * g_fixed_width_ops = nullptr;
+/* One bit for the hash of every name in `g_fixed_width_ops`. `reduce_fixed_width` is tried on every application
+   `whnf` and `lazy_delta_reduction` get stuck on, so we check it before hashing into `g_fixed_width_ops`. */
+#define FixedWidthFilterSize 1024
+static std::bitset<FixedWidthFilterSize> g_fixed_width_filter;
+
+#define FixedWidthMaxWidth 1<<24
+
+/* `BitVec.ofNat w n`, `UIntN.ofNat n` and the shift amount of `BitVec` shifts are `Nat`s */
+static bool is_fixed_width_nat_arg(fixed_width_op const & op, unsigned i) {
+    return op.m_fn == fixed_width_fn::OfNat ||
+        (op.m_kind == fixed_width_kind::BitVec && i == 2 &&
+         (op.m_fn == fixed_width_fn::ShiftLeft || op.m_fn == fixed_width_fn::ShiftRight));
+}
+
+/* If `e` reduces to a `Nat` literal, return its value. */
+optional<nat> type_checker::whnf_nat_lit(expr const & e) {
+    expr v = whnf(e);
+    if (!is_nat_lit_ext(v)) return optional<nat>();
+    return optional<nat>(get_nat_val(v));
+}
+
+/* Return the value of the operand `e` of `op`, if it reduces to a constructor application with a literal value below
+   `bound`, i.e. `2^width` for `BitVec width` and `UIntN`, and `width` for `Fin width`. */
+optional<nat> type_checker::get_fixed_width_val(fixed_width_op const & op, nat const & bound, expr const & e) {
+    expr v = whnf(e);
+    if (op.m_kind == fixed_width_kind::UInt) {
+        if (!is_app(v) || app_fn(v) != op.m_uint_mk) return optional<nat>();
+        v = whnf(app_arg(v));
+    }
+    if (op.m_kind != fixed_width_kind::Fin) {
+        if (get_app_fn(v) != *g_bitvec_of_fin || get_app_num_args(v) != 2) return optional<nat>();
+        v = whnf(app_arg(v));
+    }
+    if (get_app_fn(v) != *g_fin_mk || get_app_num_args(v) != 3) return optional<nat>();
+    optional<nat> r = whnf_nat_lit(app_arg(app_fn(v)));
+    if (!r || !(*r < bound)) return optional<nat>();
+    return r;
+}
+
+/* `2^width` */
+nat const & type_checker::get_fixed_width_modulus(unsigned width) {
+    auto it = m_st->m_fixed_width_moduli.find(width);
+    if (it != m_st->m_fixed_width_moduli.end()) return it->second;
+    nat r(nat_pow(nat(2).raw(), nat(width).raw()));
+    return m_st->m_fixed_width_moduli.insert(mk_pair(width, r)).first->second;
+}
+
+/* Successful checks of `is_fixed_width_valid`, shared by all type checkers. They are keyed by the `ConstantInfo`
+   object of the declaration checked: an environment containing it extends the one it was added to, and thus contains
+   the same declarations the check depends on. The objects are kept alive so that their addresses are not reused. */
+struct fixed_width_checks {
+    mutex                        m_mutex;
+    std::unordered_set<object *> m_valid;
+};
+static fixed_width_checks * g_fixed_width_checks = nullptr;
+
+/* Return whether the declaration `n` used by `reduce_fixed_width` is valid according to `check`, which is only invoked
+   if it has not succeeded for the same declaration before, and at most once per type checker state. While it runs,
+   `n` is considered invalid, so that `check` does not rely on the reductions it is validating. */
+template<typename F> bool type_checker::is_fixed_width_valid(name const & n, F const & check) {
+    auto it = m_st->m_fixed_width_valid.find(n);
+    if (it != m_st->m_fixed_width_valid.end()) return it->second;
+    optional<constant_info> info = env().find(n);
+    if (!info) {
+        m_st->m_fixed_width_valid[n] = false;
+        return false;
+    }
+    bool r;
+    {
+        lock_guard<mutex> lock(g_fixed_width_checks->m_mutex);
+        r = g_fixed_width_checks->m_valid.count(info->raw()) > 0;
+    }
+    if (r) {
+        m_st->m_fixed_width_valid[n] = true;
+        return true;
+    }
+    m_st->m_fixed_width_valid[n] = false;
+    try {
+        flet<local_ctx> save_lctx(m_lctx, m_lctx);
+        r = check();
+    } catch (kernel_exception &) {
+        // e.g. one of the declarations mentioned by `check` is not in the environment
+        r = false;
+    } catch (...) {
+        m_st->m_fixed_width_valid.erase(n);
+        throw;
+    }
+    m_st->m_fixed_width_valid[n] = r;
+    // a failed check may depend on declarations missing from this environment, so only successes are shared
+    if (r) {
+        lock_guard<mutex> lock(g_fixed_width_checks->m_mutex);
+        if (g_fixed_width_checks->m_valid.insert(info->raw()).second)
+            inc_ref(info->raw());
+    }
+    return r;
+}
+
+/* Check that `s` is a structure with `nparams` parameters whose constructor `mk` has type `mk_type`, as
+   `get_fixed_width_val` and the results of `reduce_fixed_width` assume for `Fin`, `BitVec` and `UIntN`. */
+bool type_checker::check_fixed_width_type(name const & s, name const & mk, unsigned nparams, expr const & mk_type) {
+    if (!is_structure_like(env(), s)) return false;
+    constant_info s_info = env().get(s);
+    inductive_val s_val  = s_info.to_inductive_val();
+    if (s_info.get_num_lparams() != 0 || s_val.get_nparams() != nparams || head(s_val.get_cnstrs()) != mk)
+        return false;
+    return is_def_eq(env().get(mk).get_type(), mk_type);
+}
+
+/* Check that the declaration `n` and the types it operates on are the ones `reduce_fixed_width` expects: we check the
+   type of `n`, and state the value (a `Nat`) of its result in terms of the ones of its operands, with the width and
+   the operands as free variables. */
+bool type_checker::check_fixed_width_op(name const & n, fixed_width_op const & op) {
+    expr nat_type = mk_constant(name{"Nat"});
+    expr fin      = mk_constant(name{"Fin"});
+    expr bitvec   = mk_constant(name{"BitVec"});
+    expr two      = mk_lit(literal(2u));
+    auto mk_local = [&](char const * un, expr const & type) { return m_lctx.mk_local_decl(m_st->m_ngen, un, type); };
+    // `Fin.mk : (n val : Nat) → LT.lt Nat instLTNat val n → Fin n`
+    bool ok = is_fixed_width_valid(const_name(fin), [&]() {
+            expr fvars[3];
+            fvars[0] = mk_local("n", nat_type);
+            fvars[1] = mk_local("val", nat_type);
+            fvars[2] = mk_local("isLt", mk_app(*g_nat_lt, fvars[1], fvars[0]));
+            return check_fixed_width_type(const_name(fin), const_name(*g_fin_mk), 1,
+                                          m_lctx.mk_pi(3, fvars, mk_app(fin, fvars[0])));
+        });
+    // `BitVec.ofFin : (w : Nat) → Fin (Nat.pow 2 w) → BitVec w`
+    if (ok && op.m_kind != fixed_width_kind::Fin) {
+        ok = is_fixed_width_valid(const_name(bitvec), [&]() {
+                expr fvars[2];
+                fvars[0] = mk_local("w", nat_type);
+                fvars[1] = mk_local("toFin", mk_app(fin, mk_app(*g_nat_pow, two, fvars[0])));
+                return check_fixed_width_type(const_name(bitvec), const_name(*g_bitvec_of_fin), 1,
+                                              m_lctx.mk_pi(2, fvars, mk_app(bitvec, fvars[0])));
+            });
+    }
+    expr width_lit = mk_lit(literal(op.m_width));
+    expr uint;
+    // `UIntN.ofBitVec : BitVec N → UIntN`
+    if (ok && op.m_kind == fixed_width_kind::UInt) {
+        uint = mk_constant(const_name(op.m_uint_mk).get_prefix());
+        ok = is_fixed_width_valid(const_name(uint), [&]() {
+                expr b = mk_local("toBitVec", mk_app(bitvec, width_lit));
+                return check_fixed_width_type(const_name(uint), const_name(op.m_uint_mk), 0, m_lctx.mk_pi(1, &b, uint));
+            });
+    }
+    if (!ok) return false;
+    constant_info info = env().get(n);
+    if (info.get_num_lparams() != 0) return false;
+    buffer<expr> fvars;
+    expr carrier, modulus;
+    if (op.m_kind == fixed_width_kind::UInt) {
+        carrier = uint;
+        modulus = mk_lit(literal(get_fixed_width_modulus(op.m_width)));
+    } else {
+        expr w  = mk_local("w", nat_type);
+        fvars.push_back(w);
+        carrier = mk_app(op.m_kind == fixed_width_kind::Fin ? fin : bitvec, w);
+        modulus = op.m_kind == fixed_width_kind::Fin ? w : mk_app(*g_nat_pow, two, w);
+    }
+    auto val = [&](expr const & x) {
+        expr v = x;
+        if (op.m_kind == fixed_width_kind::UInt)
+            v = mk_proj(const_name(uint), 0u, v);
+        if (op.m_kind != fixed_width_kind::Fin)
+            v = mk_proj(const_name(bitvec), 0u, v);
+        return mk_proj(const_name(fin), 0u, v);
+    };
+    buffer<expr> vals;
+    for (unsigned i = fvars.size(); i < op.m_nargs; i++) {
+        bool is_nat_arg = is_fixed_width_nat_arg(op, i);
+        expr x = mk_local("x", is_nat_arg ? nat_type : carrier);
+        fvars.push_back(x);
+        vals.push_back(is_nat_arg ? x : val(x));
+    }
+    expr type = op.m_fn == fixed_width_fn::ToNat ? nat_type : carrier;
+    if (!is_def_eq(info.get_type(), m_lctx.mk_pi(fvars, type))) return false;
+    expr e   = mk_app(mk_constant(n), fvars);
+    expr lhs = op.m_fn == fixed_width_fn::ToNat ? e : val(e);
+    auto mod = [&](expr const & a) { return mk_app(*g_nat_mod, a, modulus); };
+    expr rhs;
+    switch (op.m_fn) {
+    case fixed_width_fn::OfNat: rhs = mod(vals[0]); break;
+    case fixed_width_fn::ToNat: rhs = vals[0]; break;
+    case fixed_width_fn::Add:   rhs = mod(mk_app(*g_nat_add, vals[0], vals[1])); break;
+    case fixed_width_fn::Sub:   rhs = mod(mk_app(*g_nat_add, mk_app(*g_nat_sub, modulus, vals[1]), vals[0])); break;
+    case fixed_width_fn::Mul:   rhs = mod(mk_app(*g_nat_mul, vals[0], vals[1])); break;
+    case fixed_width_fn::Neg:   rhs = mod(mk_app(*g_nat_sub, modulus, vals[0])); break;
+    case fixed_width_fn::Div:   rhs = mk_app(*g_nat_div, vals[0], vals[1]); break;
+    case fixed_width_fn::Mod:   rhs = mk_app(*g_nat_mod, vals[0], vals[1]); break;
+    case fixed_width_fn::And:   rhs = mk_app(*g_nat_land, vals[0], vals[1]); break;
+    case fixed_width_fn::Or:    rhs = mk_app(*g_nat_lor, vals[0], vals[1]); break;
+    case fixed_width_fn::Xor:   rhs = mk_app(*g_nat_xor, vals[0], vals[1]); break;
+    case fixed_width_fn::ShiftLeft: case fixed_width_fn::ShiftRight: {
+        expr s = op.m_kind == fixed_width_kind::UInt ? mk_app(*g_nat_mod, vals[1], width_lit) : vals[1];
+        if (op.m_fn == fixed_width_fn::ShiftRight)
+            rhs = mk_app(*g_nat_shiftRight, vals[0], s);
+        else
+            rhs = mod(mk_app(*g_nat_shiftLeft, vals[0], s));
+        break;
+    }
+    }
+    return is_def_eq(lhs, rhs);
+}
+
+/* `Fin.mk n v (of_decide_eq_true (LT.lt Nat instLTNat v n) (Nat.decLt v n) (Eq.refl true))` */
+static expr mk_fin_lit(nat const & n, nat const & v) {
+    expr n_lit = mk_lit(literal(n));
+    expr v_lit = mk_lit(literal(v));
+    expr lt    = mk_app(*g_of_decide_eq_true, mk_app(*g_nat_lt, v_lit, n_lit), mk_app(*g_nat_dec_lt, v_lit, n_lit),
+                        *g_bool_true_refl);
+    return mk_app(*g_fin_mk, n_lit, v_lit, lt);
+}
+
+optional<expr> type_checker::reduce_fixed_width(expr const & e) {
+    if (!is_app(e)) return none_expr();
+    expr const & f = get_app_fn(e);
+    if (!is_constant(f) || !g_fixed_width_filter[const_name(f).hash() % FixedWidthFilterSize]) return none_expr();
+    auto it = g_fixed_width_ops->find(const_name(f));
+    if (it == g_fixed_width_ops->end()) return none_expr();
+    fixed_width_op const & op = it->second;
+    buffer<expr> args;
+    get_app_args(e, args);
+    if (args.size() != op.m_nargs) return none_expr();
+    /* For `BitVec` and `Fin`, the first argument is the width, the remaining ones are the operands. */
+    unsigned first = 0;
+    nat width;
+    if (op.m_kind == fixed_width_kind::UInt) {
+        width = nat(op.m_width);
+    } else {
+        optional<nat> w = whnf_nat_lit(args[0]);
+        if (!w || *w > nat(FixedWidthMaxWidth)) return none_expr();
+        if (op.m_kind == fixed_width_kind::Fin && w->is_zero()) return none_expr();
+        width = *w;
+        first = 1;
+    }
+    nat modulus = op.m_kind == fixed_width_kind::Fin ? width : get_fixed_width_modulus(width.get_small_value());
+    buffer<nat> vals;
+    for (unsigned i = first; i < args.size(); i++) {
+        optional<nat> v = is_fixed_width_nat_arg(op, i) ? whnf_nat_lit(args[i])
+                                                        : get_fixed_width_val(op, modulus, args[i]);
+        if (!v) return none_expr();
+        vals.push_back(*v);
+    }
+    if (!is_fixed_width_valid(const_name(f), [&]() { return check_fixed_width_op(const_name(f), op); }))
+        return none_expr();
+    nat r;
+    switch (op.m_fn) {
+    case fixed_width_fn::OfNat: r = vals[0] % modulus; break;
+    case fixed_width_fn::ToNat: r = vals[0]; break;
+    case fixed_width_fn::Add:   r = (vals[0] + vals[1]) % modulus; break;
+    case fixed_width_fn::Sub:   r = ((modulus - vals[1]) + vals[0]) % modulus; break;
+    case fixed_width_fn::Mul:   r = (vals[0] * vals[1]) % modulus; break;
+    case fixed_width_fn::Neg:   r = (modulus - vals[0]) % modulus; break;
+    case fixed_width_fn::Div:   r = vals[0] / vals[1]; break;
+    case fixed_width_fn::Mod:   r = vals[0] % vals[1]; break;
+    case fixed_width_fn::And:   r = nat(nat_land(vals[0].raw(), vals[1].raw())); break;
+    case fixed_width_fn::Or:    r = nat(nat_lor(vals[0].raw(), vals[1].raw())); break;
+    case fixed_width_fn::Xor:   r = nat(nat_lxor(vals[0].raw(), vals[1].raw())); break;
+    case fixed_width_fn::ShiftLeft: case fixed_width_fn::ShiftRight: {
+        // `UIntN` shifts take the shift amount modulo the width
+        nat s = op.m_kind == fixed_width_kind::UInt ? vals[1] % width : vals[1];
+        if (op.m_fn == fixed_width_fn::ShiftRight)
+            r = s < width ? nat(lean_nat_shiftr(vals[0].raw(), s.raw())) : nat(0u);
+        else
+            r = s < width ? nat(lean_nat_shiftl(vals[0].raw(), s.raw())) % modulus : nat(0u);
+        break;
+    }
+    }
+    count(reduction_stats::FixedWidthReduction);
+    if (op.m_fn == fixed_width_fn::ToNat)
+        return some_expr(mk_lit(literal(r)));
+    expr v = mk_fin_lit(modulus, r);
+    if (op.m_kind == fixed_width_kind::Fin)
+        return some_expr(v);
+    v = mk_app(*g_bitvec_of_fin, mk_lit(literal(width)), v);
+    if (op.m_kind == fixed_width_kind::UInt)
+        v = mk_app(op.m_uint_mk, v);
+    return some_expr(v);
+}
+
 /** \brief Put expression \c t in weak head normal form */
 expr type_checker::whnf(expr const & e) {
     // Do not cache easy cases
@@ -668,27 +1013,47 @@ expr type_checker::whnf(expr const & e) {
     }
 
     // check cache
+    count(reduction_stats::Whnf);
     auto it = m_st->m_whnf.find(e);
-    if (it != m_st->m_whnf.end())
+    if (it != m_st->m_whnf.end()) {
+        count(reduction_stats::WhnfCacheHit);
         return it->second;
+    }
 
+    bool share = m_shared_cache && shared_cache::is_cacheable(e);
+    if (share) {
+        if (optional<expr> r = m_shared_cache->find(shared_cache::kind::Whnf, e)) {
+            count(reduction_stats::WhnfCacheHit);
+            m_st->m_whnf.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
+    scoped_reduction_timer timer(m_stats, reduction_stats::WhnfTime);
+    expr r;
     expr t = e;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
+        } else if (auto v = reduce_fixed_width(t1)) {
+            r = *v;
+            break;
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            r = t1;
+            break;
         }
     }
+    m_st->m_whnf.insert(mk_pair(e, r));
+    if (share)
+        m_shared_cache->insert(shared_cache::kind::Whnf, e, r);
+    return r;
 }
 
 /** \brief Given lambda/Pi expressions \c t and \c s, return true iff \c t is def eq to \c s.
@@ -809,6 +1174,7 @@ bool type_checker::try_eta_struct_core(expr const & t, expr const & s) {
     constructor_val f_val = f_info.to_constructor_val();
     if (get_app_num_args(s) != f_val.get_nparams() + f_val.get_nfields()) return false;
     if (!is_structure_like(env(), f_val.get_induct())) return false;
+    count(reduction_stats::EtaStruct);
     if (!is_def_eq(infer_type(t), infer_type(s))) return false;
     buffer<expr> s_args;
     get_app_args(s, s_args);
@@ -816,6 +1182,7 @@ bool type_checker::try_eta_struct_core(expr const & t, expr const & s) {
         expr proj = mk_proj(f_val.get_induct(), i - f_val.get_nparams(), t);
         if (!is_def_eq(proj, s_args[i])) return false;
     }
+    count(reduction_stats::EtaStructSuccess);
     return true;
 }
 
@@ -849,8 +1216,12 @@ lbool type_checker::is_def_eq_proof_irrel(expr const & t, expr const & s) {
     expr t_type = infer_type(t);
     if (!is_prop(t_type))
         return l_undef;
+    count(reduction_stats::ProofIrrel);
     expr s_type = infer_type(s);
-    return to_lbool(is_def_eq(t_type, s_type));
+    bool r = is_def_eq(t_type, s_type);
+    if (r)
+        count(reduction_stats::ProofIrrelSuccess);
+    return to_lbool(r);
 }
 
 bool type_checker::failed_before(expr const & t, expr const & s) const {
@@ -893,6 +1264,7 @@ optional<expr> type_checker::try_unfold_proj_app(expr const & e) {
 
      \remark t_n, s_n and cs are updated. */
 auto type_checker::lazy_delta_reduction_step(expr & t_n, expr & s_n) -> reduction_status {
+    count(reduction_stats::LazyDeltaStep);
     auto d_t = is_delta(t_n);
     auto d_s = is_delta(s_n);
     if (!d_t && !d_s) {
@@ -937,6 +1309,8 @@ auto type_checker::lazy_delta_reduction_step(expr & t_n, expr & s_n) -> reductio
                     } else {
                         cache_failure(t_n, s_n);
                     }
+                } else {
+                    count(reduction_stats::FailureCacheHit);
                 }
             }
             t_n = whnf_core(*unfold_definition(t_n), false, true);
@@ -982,6 +1356,7 @@ lbool type_checker::is_def_eq_offset(expr const & t, expr const & s) {
 
 /** \remark t_n, s_n are updated. */
 lbool type_checker::lazy_delta_reduction(expr & t_n, expr & s_n) {
+    scoped_reduction_timer timer(m_stats, reduction_stats::LazyDeltaTime);
     while (true) {
         lbool r = is_def_eq_offset(t_n, s_n);
         if (r != l_undef) return r;
@@ -991,6 +1366,10 @@ lbool type_checker::lazy_delta_reduction(expr & t_n, expr & s_n) {
                 return to_lbool(is_def_eq_core(*t_v, s_n));
             } else if (auto s_v = reduce_nat(s_n)) {
                 return to_lbool(is_def_eq_core(t_n, *s_v));
+            } else if (auto t_v = reduce_fixed_width(t_n)) {
+                return to_lbool(is_def_eq_core(*t_v, s_n));
+            } else if (auto s_v = reduce_fixed_width(s_n)) {
+                return to_lbool(is_def_eq_core(t_n, *s_v));
             }
         }
 
@@ -1172,17 +1551,21 @@ expr type_checker::eta_expand(expr const & e) {
 }
 
 type_checker::type_checker(environment const & env, local_ctx const & lctx, diagnostics * diag, definition_safety ds):
-    m_st_owner(true), m_st(new state(env)), m_diag(diag),
+    m_st_owner(true), m_st(new state(env)), m_diag(diag), m_stats(diag ? diag->stats() : nullptr),
+    // A hit in the shared cache skips the unfoldings and reductions that produced the result, so it is not used
+    // while collecting diagnostics, which would otherwise depend on the order declarations were checked in.
+    m_shared_cache(ds == definition_safety::safe && !diag ? env.get_shared_cache() : nullptr),
     m_lctx(lctx), m_definition_safety(ds), m_lparams(nullptr) {
 }
 
 type_checker::type_checker(state & st, local_ctx const & lctx, definition_safety ds):
-    m_st_owner(false), m_st(&st), m_diag(nullptr), m_lctx(lctx),
+    m_st_owner(false), m_st(&st), m_diag(nullptr), m_stats(nullptr), m_shared_cache(nullptr), m_lctx(lctx),
     m_definition_safety(ds), m_lparams(nullptr) {
 }
 
 type_checker::type_checker(type_checker && src):
-    m_st_owner(src.m_st_owner), m_st(src.m_st), m_diag(src.m_diag), m_lctx(std::move(src.m_lctx)),
+    m_st_owner(src.m_st_owner), m_st(src.m_st), m_diag(src.m_diag), m_stats(src.m_stats), m_shared_cache(src.m_shared_cache),
+    m_lctx(std::move(src.m_lctx)),
     m_definition_safety(src.m_definition_safety), m_lparams(src.m_lparams) {
     src.m_st_owner = false;
 }
@@ -1220,6 +1603,51 @@ void initialize_type_checker() {
     g_nat_xor      = new_persistent_expr_const({"Nat", "xor"});
     g_nat_shiftLeft  = new_persistent_expr_const({"Nat", "shiftLeft"});
     g_nat_shiftRight = new_persistent_expr_const({"Nat", "shiftRight"});
+    g_nat_lt       = new expr(mk_app(mk_constant(name{"LT", "lt"}, levels(mk_level_zero())), mk_constant(name{"Nat"}),
+                                     mk_constant(name{"instLTNat"})));
+    mark_persistent(g_nat_lt->raw());
+    g_nat_dec_lt   = new_persistent_expr_const({"Nat", "decLt"});
+    g_of_decide_eq_true = new_persistent_expr_const({"of_decide_eq_true"});
+    g_bool_true_refl = new expr(mk_app(mk_constant(name{"Eq", "refl"}, levels(mk_level_one())), mk_constant(name{"Bool"}),
+                                       mk_constant(name{"Bool", "true"})));
+    mark_persistent(g_bool_true_refl->raw());
+    g_fin_mk       = new_persistent_expr_const({"Fin", "mk"});
+    g_bitvec_of_fin = new_persistent_expr_const({"BitVec", "ofFin"});
+    g_fixed_width_ops = new name_hash_map<fixed_width_op>();
+    g_fixed_width_checks = new fixed_width_checks();
+    auto add_op = [](name const & n, fixed_width_kind k, fixed_width_fn fn, unsigned nargs, unsigned width = 0) {
+        expr uint_mk = k == fixed_width_kind::UInt ? mk_constant(name(n.get_prefix(), "ofBitVec")) : expr();
+        g_fixed_width_ops->insert(mk_pair(n, fixed_width_op{k, fn, nargs, width, uint_mk}));
+        g_fixed_width_filter.set(n.hash() % FixedWidthFilterSize);
+    };
+    struct fn_name { fixed_width_fn m_fn; char const * m_bitvec; char const * m_uint; char const * m_fin; unsigned m_nargs; };
+    // `m_nargs` is the number of operands, the `BitVec` and `Fin` versions also take the width
+    fn_name const fns[] = {
+        {fixed_width_fn::OfNat,      "ofNat",       "ofNat",      nullptr, 1},
+        {fixed_width_fn::ToNat,      "toNat",       "toNat",      nullptr, 1},
+        {fixed_width_fn::Add,        "add",         "add",        "add",   2},
+        {fixed_width_fn::Sub,        "sub",         "sub",        "sub",   2},
+        {fixed_width_fn::Mul,        "mul",         "mul",        "mul",   2},
+        {fixed_width_fn::Neg,        "neg",         "neg",        nullptr, 1},
+        {fixed_width_fn::Div,        "udiv",        "div",        "div",   2},
+        {fixed_width_fn::Mod,        "umod",        "mod",        "mod",   2},
+        {fixed_width_fn::And,        "and",         "land",       nullptr, 2},
+        {fixed_width_fn::Or,         "or",          "lor",        nullptr, 2},
+        {fixed_width_fn::Xor,        "xor",         "xor",        nullptr, 2},
+        {fixed_width_fn::ShiftLeft,  "shiftLeft",   "shiftLeft",  nullptr, 2},
+        {fixed_width_fn::ShiftRight, "ushiftRight", "shiftRight", nullptr, 2},
+    };
+    for (fn_name const & fn : fns) {
+        add_op(name{"BitVec", fn.m_bitvec}, fixed_width_kind::BitVec, fn.m_fn, fn.m_nargs + 1);
+        if (fn.m_fin)
+            add_op(name{"Fin", fn.m_fin}, fixed_width_kind::Fin, fn.m_fn, fn.m_nargs + 1);
+        if (fn.m_uint) {
+            add_op(name{"UInt8",  fn.m_uint}, fixed_width_kind::UInt, fn.m_fn, fn.m_nargs, 8);
+            add_op(name{"UInt16", fn.m_uint}, fixed_width_kind::UInt, fn.m_fn, fn.m_nargs, 16);
+            add_op(name{"UInt32", fn.m_uint}, fixed_width_kind::UInt, fn.m_fn, fn.m_nargs, 32);
+            add_op(name{"UInt64", fn.m_uint}, fixed_width_kind::UInt, fn.m_fn, fn.m_nargs, 64);
+        }
+    }
     g_string_mk    = new_persistent_expr_const({"String", "mk"});
     g_lean_reduce_bool = new_persistent_expr_const({"Lean", "reduceBool"});
     g_lean_reduce_nat  = new_persistent_expr_const({"Lean", "reduceNat"});
@@ -1246,6 +1674,15 @@ void finalize_type_checker() {
     delete g_nat_xor;
     delete g_nat_shiftLeft;
     delete g_nat_shiftRight;
+    delete g_nat_lt;
+    delete g_nat_dec_lt;
+    delete g_of_decide_eq_true;
+    delete g_bool_true_refl;
+    delete g_fin_mk;
+    delete g_bitvec_of_fin;
+    delete g_fixed_width_ops;
+    // the `ConstantInfo` objects it keeps alive are leaked
+    delete g_fixed_width_checks;
     delete g_string_mk;
     delete g_lean_reduce_bool;
     delete g_lean_reduce_nat;
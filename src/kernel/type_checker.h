@@ -6,19 +6,24 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <unordered_set>
+#include <unordered_map>
 #include <memory>
 #include <utility>
 #include <algorithm>
 #include "runtime/flet.h"
 #include "util/lbool.h"
 #include "util/name_set.h"
+#include "util/name_hash_map.h"
 #include "util/name_generator.h"
 #include "kernel/environment.h"
 #include "kernel/local_ctx.h"
 #include "kernel/expr_maps.h"
 #include "kernel/equiv_manager.h"
+#include "kernel/shared_cache.h"
 
 namespace lean {
+struct fixed_width_op;
+
 /** \brief Lean Type Checker. It can also be used to infer types, check whether a
     type \c A is convertible to a type \c B, etc. */
 class type_checker {
@@ -33,6 +38,11 @@ public:
         expr_map<expr>            m_whnf;
         equiv_manager             m_eqv_manager;
         expr_pair_set             m_failure;
+        /* Whether the declarations used by `reduce_fixed_width` agree with the ones in `Init`, in front of the
+           process-wide cache of successful checks, see `type_checker::is_fixed_width_valid` */
+        name_hash_map<bool>       m_fixed_width_valid;
+        // `2^w` for the widths `w` of the fixed-width literals reduced so far
+        std::unordered_map<unsigned, nat> m_fixed_width_moduli;
         friend type_checker;
     public:
         state(environment const & env);
@@ -44,12 +54,20 @@ private:
     bool                      m_st_owner;
     state *                   m_st;
     diagnostics *             m_diag;
+    // `nullptr` unless kernel reduction statistics are collected, see `diagnostics::stats`
+    reduction_stats *         m_stats;
+    // see `shared_cache`; only used when checking safe declarations
+    shared_cache *            m_shared_cache;
     local_ctx                 m_lctx;
     definition_safety         m_definition_safety;
     /* When `m_lparams != nullptr, the `check` method makes sure all level parameters
        are in `m_lparams`. */
     names const *             m_lparams;
 
+    void count(reduction_stats::counter c) {
+        if (m_stats) m_stats->m_counters[c]++;
+    }
+
     expr ensure_sort_core(expr e, expr const & s);
     expr ensure_pi_core(expr e, expr const & s);
     void check_level(level const & l);
@@ -103,7 +121,15 @@ private:
     template<typename F> optional<expr> reduce_bin_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_pred(F const & f, expr const & e);
     optional<expr> reduce_pow(expr const & e);
+    optional<expr> reduce_nat_core(expr const & e);
     optional<expr> reduce_nat(expr const & e);
+    optional<nat> whnf_nat_lit(expr const & e);
+    optional<nat> get_fixed_width_val(fixed_width_op const & op, nat const & bound, expr const & e);
+    nat const & get_fixed_width_modulus(unsigned width);
+    template<typename F> bool is_fixed_width_valid(name const & n, F const & check);
+    bool check_fixed_width_type(name const & s, name const & mk, unsigned nparams, expr const & mk_type);
+    bool check_fixed_width_op(name const & n, fixed_width_op const & op);
+    optional<expr> reduce_fixed_width(expr const & e);
 public:
     // The following two constructor are used only by the old compiler and should be deleted with it
     type_checker(state & st, local_ctx const & lctx, definition_safety ds = definition_safety::safe);
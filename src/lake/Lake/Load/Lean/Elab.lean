@@ -99,8 +99,12 @@ def importConfigFileCore (olean : FilePath) (leanOpts : Options) : IO Environmen
   on top of it like the elaborator would. Thus the non-shared part of the
   `Environment` is very small.
   -/
-  let (mod, _) ← readModuleData olean
+  let (mod, region) ← readModuleData olean
   let env ← importModulesUsingCache mod.imports leanOpts 1024
+  -- Only `mod.imports` may be accessed before the files it references are checked to be loaded.
+  unless (← region.hasValidExternalRefs) do
+    throw <| IO.userError s!"{olean}: configuration file references other .olean files that \
+      could not be loaded at the same address or have changed"
   -- Apply constants (does not go through the kernel, so order is irrelevant)
   let env := mod.constants.foldl addToEnv env
   /-
@@ -8,11 +8,13 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 */
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include <utility>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <climits>
 #include <sys/stat.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
@@ -22,6 +24,7 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "runtime/compact.h"
 #include "runtime/buffer.h"
 #include "util/io.h"
+#include "util/lz_block.h"
 #include "util/name_map.h"
 #include "library/module.h"
 #include "library/constants.h"
@@ -49,17 +52,23 @@ namespace lean {
 struct olean_header {
     // 5 bytes: magic number
     char marker[5] = {'o', 'l', 'e', 'a', 'n'};
-    // 1 byte: version, incremented on structural changes to header
-    uint8_t version = 2;
+    // 1 byte: version, incremented on structural changes to header or payload layout
+    uint8_t version = 5;
     // 1 byte of flags:
     // * bit 0: whether persisted bignums use GMP or Lean-native encoding
-    // * bit 1-7: reserved
+    // * bit 1: whether the payload is compressed, see `olean_flag_compressed`
+    // * bit 2: whether object headers contain the biased reference counting fields (`LEAN_BIASED_RC`)
+    // * bit 3-7: reserved
     uint8_t flags =
 #ifdef LEAN_USE_GMP
-        0b1;
+        0b1
 #else
-        0b0;
+        0b0
 #endif
+#ifdef LEAN_BIASED_RC
+        | 0b100
+#endif
+        ;
     // 33 bytes: Lean version string, padded with '\0' to the right
     // e.g. "4.12.0-nightly-2024-10-18". Other suffixes after the version
     // triple currently in use are `-rcN` for some `N` and `-pre` for any
@@ -70,11 +79,156 @@ struct olean_header {
     char githash[40];
     // address at which the beginning of the file (including header) is attempted to be mmapped
     size_t base_addr;
+    // hash of the uncompressed payload including the indices below, identifies the contents of the file
+    uint64_t content_hash;
+    // size of the payload below including the indices, before compression
+    uint64_t payload_size;
     // payload, a serialize Lean object graph; `size_t` has same alignment requirements as Lean objects
+    // It is followed by the chunk index of the object graph (see `object_compactor::chunk_offsets`), i.e. `n`
+    // `size_t` offsets into `data`, and by `n` itself as a `size_t`. Finally, there is the index of other
+    // .olean files referenced by the object graph (see `LEAN_OLEAN_SHARE_IMPORTS`), i.e. `m` triples of
+    // their base address, file size, and content hash as `size_t`s, followed by `m` itself.
     size_t data[];
 };
 // make sure we don't have any padding bytes, which also ensures `data` is properly aligned
-static_assert(sizeof(olean_header) == 5 + 1 + 1 + 33 + 40 + sizeof(size_t), "olean_header must be packed");
+static_assert(sizeof(olean_header) == 5 + 1 + 1 + 33 + 40 + sizeof(size_t) + 2 * sizeof(uint64_t), "olean_header must be packed");
+
+/* If set, the payload described above (including the chunk index) is stored compressed: it is split into blocks
+   of `LEAN_OLEAN_BLOCK_SIZE` uncompressed bytes (except for the last one). Each block is stored as a `uint32_t` size followed by that many bytes of
+   `lz_compress` output, or of uncompressed data if `olean_block_stored` is set in the size.
+   Compressed files cannot be `mmap`ped and are written only if `LEAN_OLEAN_COMPRESS=1` is set. */
+static constexpr uint8_t olean_flag_compressed = 0b10;
+static constexpr uint32_t olean_block_stored   = 0x80000000u;
+#define LEAN_OLEAN_BLOCK_SIZE (1024*1024)
+// upper bound on `olean_header::payload_size` accepted for compressed files, whose buffer is allocated before reading
+#define LEAN_OLEAN_MAX_PAYLOAD_SIZE (static_cast<uint64_t>(1) << 32)
+
+static bool olean_compress_enabled() {
+    char const * c = std::getenv("LEAN_OLEAN_COMPRESS");
+    return c && strcmp(c, "1") == 0;
+}
+
+static void write_compressed_payload(std::ofstream & out, std::vector<char> const & payload) {
+    std::vector<uint8_t> block(lz_compress_bound(LEAN_OLEAN_BLOCK_SIZE));
+    for (size_t off = 0; off < payload.size(); off += LEAN_OLEAN_BLOCK_SIZE) {
+        size_t sz = std::min(payload.size() - off, static_cast<size_t>(LEAN_OLEAN_BLOCK_SIZE));
+        uint8_t const * raw = reinterpret_cast<uint8_t const *>(payload.data() + off);
+        uint32_t csz = lz_compress(raw, sz, block.data());
+        if (csz < sz) {
+            out.write(reinterpret_cast<char const *>(&csz), sizeof(csz));
+            out.write(reinterpret_cast<char const *>(block.data()), csz);
+        } else {
+            uint32_t ssz = static_cast<uint32_t>(sz) | olean_block_stored;
+            out.write(reinterpret_cast<char const *>(&ssz), sizeof(ssz));
+            out.write(reinterpret_cast<char const *>(raw), sz);
+        }
+    }
+}
+
+/* Decompress the blocks of the payload, see `olean_flag_compressed`, directly into `buffer`. */
+static bool read_compressed_payload(std::ifstream & in, char * buffer, size_t raw_size) {
+    std::vector<uint8_t> block;
+    for (size_t off = 0; off < raw_size; off += LEAN_OLEAN_BLOCK_SIZE) {
+        size_t sz = std::min(raw_size - off, static_cast<size_t>(LEAN_OLEAN_BLOCK_SIZE));
+        uint32_t csz;
+        if (!in.read(reinterpret_cast<char *>(&csz), sizeof(csz)))
+            return false;
+        if (csz & olean_block_stored) {
+            if ((csz & ~olean_block_stored) != sz || !in.read(buffer + off, sz))
+                return false;
+        } else {
+            if (csz > lz_compress_bound(sz))
+                return false;
+            block.resize(csz);
+            if (!in.read(reinterpret_cast<char *>(block.data()), csz)
+                || !lz_decompress(block.data(), csz, reinterpret_cast<uint8_t *>(buffer + off), sz))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* The uncompressed .olean files loaded in this process, as ranges of the whole file at their base address
+   together with the address their payload was actually loaded at. If `LEAN_OLEAN_SHARE_IMPORTS=1` is set,
+   `lean_save_module_data` references the objects in the ones `mmap`ped at their base address, e.g. names
+   and expressions of imported declarations, instead of copying them into the new file. Such a file can only
+   be imported if all the files it references are loaded again with the same contents, which is checked by
+   `lean_compacted_region_has_valid_external_refs` before any of its declarations are accessed. If one of
+   them could not be `mmap`ped at its base address anymore, e.g. because of an unlucky address space layout,
+   the references into it are relocated instead. This mainly saves disk space and page cache for large
+   projects, at the price of losing relocatability. */
+struct olean_region {
+    external_region m_file;
+    char const *    m_data;
+};
+struct olean_region_registry {
+    mutex m_mutex;
+    std::vector<olean_region> m_regions;
+};
+// never freed as regions may be unregistered during process shutdown
+static olean_region_registry * g_olean_regions = new olean_region_registry();
+
+static void register_olean_region(external_region const & r, char const * data) {
+    lock_guard<mutex> lock(g_olean_regions->m_mutex);
+    g_olean_regions->m_regions.push_back(olean_region{r, data});
+}
+
+static void unregister_olean_region(char const * data) {
+    lock_guard<mutex> lock(g_olean_regions->m_mutex);
+    std::vector<olean_region> & rs = g_olean_regions->m_regions;
+    rs.erase(std::remove_if(rs.begin(), rs.end(), [&](olean_region const & r) { return r.m_data == data; }), rs.end());
+}
+
+static std::vector<external_region> mapped_olean_regions() {
+    lock_guard<mutex> lock(g_olean_regions->m_mutex);
+    std::vector<external_region> rs;
+    for (olean_region const & r : g_olean_regions->m_regions) {
+        if (r.m_data == r.m_file.m_begin + sizeof(olean_header))
+            rs.push_back(r.m_file);
+    }
+    return rs;
+}
+
+/* Return the address the payload of the given file was loaded at, or `nullptr` if it is not loaded. */
+static char const * find_olean_region(external_region const & r) {
+    lock_guard<mutex> lock(g_olean_regions->m_mutex);
+    char const * data = nullptr;
+    for (olean_region const & o : g_olean_regions->m_regions) {
+        if (o.m_file.m_begin == r.m_begin && o.m_file.m_size == r.m_size && o.m_file.m_hash == r.m_hash) {
+            data = o.m_data;
+            // prefer a mapping at the original address, which does not need relocation
+            if (data == r.m_begin + sizeof(olean_header))
+                break;
+        }
+    }
+    return data;
+}
+
+static bool olean_share_imports_enabled() {
+    char const * c = std::getenv("LEAN_OLEAN_SHARE_IMPORTS");
+    return c && strcmp(c, "1") == 0;
+}
+
+static std::unique_ptr<object_compactor> compact_module_data(size_t base_addr, b_obj_arg mdata, std::vector<external_region> const & imported) {
+    std::unique_ptr<object_compactor> compactor(new object_compactor(reinterpret_cast<void *>(base_addr + offsetof(olean_header, data))));
+    compactor->set_external_regions(imported);
+    // Each declaration and the entries of each environment extension form a section, which lets the compactor
+    // split the work into partitions, see `object_compactor::operator()`.
+    // The `imports` are read before the imported files are loaded and so must not reference them.
+    // see/sync with `ModuleData` in `Environment.lean`
+    object * imports     = cnstr_get(mdata, 0);
+    object * constants   = cnstr_get(mdata, 2);
+    object * entries     = cnstr_get(mdata, 4);
+    compactor->add_section(imports, /* allow_external */ false);
+    for (size_t i = 0; i < array_size(constants); i++) {
+        compactor->add_section(array_cptr(constants)[i]);
+    }
+    for (size_t i = 0; i < array_size(entries); i++) {
+        compactor->add_section(array_cptr(entries)[i]);
+    }
+    (*compactor)(mdata);
+    return compactor;
+}
 
 extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
     std::string olean_fn(string_cstr(fname));
@@ -105,16 +259,66 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
         // `MapViewOfFileEx` addresses must be aligned to the "memory allocation granularity", which is 64KB.
         base_addr = base_addr & ~((1LL<<16) - 1);
 
-        object_compactor compactor(reinterpret_cast<void *>(base_addr + offsetof(olean_header, data)));
-        compactor(mdata);
+        std::vector<external_region> imported;
+        if (olean_share_imports_enabled())
+            imported = mapped_olean_regions();
+        std::unique_ptr<object_compactor> compactor;
+        std::vector<size_t> ext_index;
+        while (true) {
+            compactor = compact_module_data(base_addr, mdata, imported);
+            // We cannot reference files that overlap with the range at which this file will be mapped, so
+            // compact again without them if necessary. This rarely happens and terminates as each round
+            // removes at least one of them.
+            std::vector<external_region> used = compactor->used_external_regions();
+            size_t file_end = base_addr + sizeof(olean_header) + compactor->size()
+                + (compactor->chunk_offsets().size() + 1 + 3 * used.size() + 1) * sizeof(size_t);
+            auto overlaps = [&](external_region const & r) {
+                return reinterpret_cast<size_t>(r.m_begin) < file_end && base_addr < reinterpret_cast<size_t>(r.m_begin) + r.m_size;
+            };
+            if (std::none_of(used.begin(), used.end(), overlaps)) {
+                for (external_region const & r : used) {
+                    ext_index.push_back(reinterpret_cast<size_t>(r.m_begin));
+                    ext_index.push_back(r.m_size);
+                    ext_index.push_back(r.m_hash);
+                }
+                break;
+            }
+            imported.erase(std::remove_if(imported.begin(), imported.end(), overlaps), imported.end());
+        }
 
         // see/sync with file format description above
+        std::vector<size_t> const & chunk_offsets = compactor->chunk_offsets();
+        size_t num_chunks = chunk_offsets.size();
+        size_t num_ext = ext_index.size() / 3;
+        std::pair<char const *, size_t> payload_parts[] = {
+            {static_cast<char const *>(compactor->data()), compactor->size()},
+            {reinterpret_cast<char const *>(chunk_offsets.data()), num_chunks * sizeof(size_t)},
+            {reinterpret_cast<char const *>(&num_chunks), sizeof(num_chunks)},
+            {reinterpret_cast<char const *>(ext_index.data()), ext_index.size() * sizeof(size_t)},
+            {reinterpret_cast<char const *>(&num_ext), sizeof(num_ext)},
+        };
+        bool compress = olean_compress_enabled();
         olean_header header = {};
         header.base_addr = base_addr;
+        header.content_hash = 11;
+        for (auto const & p : payload_parts) {
+            header.content_hash = hash_str(p.second, reinterpret_cast<unsigned char const *>(p.first), header.content_hash);
+            header.payload_size += p.second;
+        }
+        if (compress)
+            header.flags |= olean_flag_compressed;
         strncpy(header.lean_version, get_short_version_string().c_str(), sizeof(header.lean_version));
         strncpy(header.githash, LEAN_GITHASH, sizeof(header.githash));
         out.write(reinterpret_cast<char *>(&header), sizeof(header));
-        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        if (compress) {
+            std::vector<char> payload;
+            for (auto const & p : payload_parts)
+                payload.insert(payload.end(), p.first, p.first + p.second);
+            write_compressed_payload(out, payload);
+        } else {
+            for (auto const & p : payload_parts)
+                out.write(p.first, p.second);
+        }
         out.close();
         while (std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
 #ifdef LEAN_WINDOWS
@@ -160,7 +364,8 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             || memcmp(header.marker, default_header.marker, sizeof(header.marker)) != 0) {
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
-        if (header.version != default_header.version || header.flags != default_header.flags
+        bool is_compressed = (header.flags & olean_flag_compressed) != 0;
+        if (header.version != default_header.version || (header.flags & ~olean_flag_compressed) != default_header.flags
 #ifdef LEAN_CHECK_OLEAN_VERSION
             || strncmp(header.githash, LEAN_GITHASH, sizeof(header.githash)) != 0
 #endif
@@ -171,59 +376,131 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         char * buffer = nullptr;
         bool is_mmap = false;
         std::function<void()> free_data;
+        size_t data_size = size - sizeof(olean_header);
+        if (!is_compressed && header.payload_size != data_size) {
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        }
+        if (is_compressed) {
+            uint64_t raw_size = header.payload_size;
+            // every block takes up at least its size field in the file
+            if (raw_size % sizeof(size_t) != 0 || raw_size > LEAN_OLEAN_MAX_PAYLOAD_SIZE || raw_size > SIZE_MAX
+                || raw_size / LEAN_OLEAN_BLOCK_SIZE > data_size / sizeof(uint32_t)) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid compressed payload").str());
+            }
+            data_size = raw_size;
+            buffer = static_cast<char *>(malloc(data_size));
+            if (buffer == nullptr) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', out of memory").str());
+            }
+            free_data = [=]() {
+                free_sized(buffer, data_size);
+            };
+            if (!read_compressed_payload(in, buffer, data_size)) {
+                free_data();
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid compressed payload").str());
+            }
+        } else {
 #ifdef LEAN_WINDOWS
-        // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
-        HANDLE h_olean_fn = CreateFile(olean_fn.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (h_olean_fn == INVALID_HANDLE_VALUE) {
-            return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << GetLastError()).str());
-        }
-        HANDLE h_map = CreateFileMapping(h_olean_fn, NULL, PAGE_READONLY, 0, 0, NULL);
-        if (h_olean_fn == NULL) {
-            return io_result_mk_error((sstream() << "failed to map '" << olean_fn << "': " << GetLastError()).str());
-        }
-        buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_READ, 0, 0, 0, base_addr));
-        free_data = [=]() {
-            if (buffer) {
-                lean_always_assert(UnmapViewOfFile(base_addr));
+            // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
+            HANDLE h_olean_fn = CreateFile(olean_fn.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (h_olean_fn == INVALID_HANDLE_VALUE) {
+                return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << GetLastError()).str());
             }
-            lean_always_assert(CloseHandle(h_map));
-            lean_always_assert(CloseHandle(h_olean_fn));
-        };
+            HANDLE h_map = CreateFileMapping(h_olean_fn, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (h_olean_fn == NULL) {
+                return io_result_mk_error((sstream() << "failed to map '" << olean_fn << "': " << GetLastError()).str());
+            }
+            buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_READ, 0, 0, 0, base_addr));
+            free_data = [=]() {
+                if (buffer) {
+                    lean_always_assert(UnmapViewOfFile(base_addr));
+                }
+                lean_always_assert(CloseHandle(h_map));
+                lean_always_assert(CloseHandle(h_olean_fn));
+            };
 #else
-        int fd = open(olean_fn.c_str(), O_RDONLY);
-        if (fd == -1) {
-            return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << strerror(errno)).str());
-        }
-#ifdef LEAN_MMAP
-        buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
-#endif
-        close(fd);
-        free_data = [=]() {
-            if (buffer != MAP_FAILED) {
-                lean_always_assert(munmap(buffer, size) == 0);
+            int fd = open(olean_fn.c_str(), O_RDONLY);
+            if (fd == -1) {
+                return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << strerror(errno)).str());
             }
-        };
-#endif
-        if (buffer && buffer == base_addr) {
-            buffer += sizeof(olean_header);
-            is_mmap = true;
-        } else {
 #ifdef LEAN_MMAP
-            free_data();
+            buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
 #endif
-            buffer = static_cast<char *>(malloc(size - sizeof(olean_header)));
+            close(fd);
             free_data = [=]() {
-                free_sized(buffer, size - sizeof(olean_header));
+                if (buffer != MAP_FAILED) {
+                    lean_always_assert(munmap(buffer, size) == 0);
+                }
             };
-            in.read(buffer, size - sizeof(olean_header));
-            if (!in) {
-                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+#endif
+            if (buffer && buffer == base_addr) {
+                // No `madvise(MADV_WILLNEED)` here: `importModulesCore` has already requested readahead of the
+                // whole file with `lean_prefetch_module_data` when it first encountered the import.
+                register_olean_region(external_region{buffer, size, header.content_hash}, buffer + sizeof(olean_header));
+                std::function<void()> unmap = free_data;
+                free_data = [=]() {
+                    unregister_olean_region(base_addr + sizeof(olean_header));
+                    unmap();
+                };
+                buffer += sizeof(olean_header);
+                is_mmap = true;
+            } else {
+#ifdef LEAN_MMAP
+                free_data();
+#endif
+                buffer = static_cast<char *>(malloc(size - sizeof(olean_header)));
+                if (buffer == nullptr) {
+                    return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', out of memory").str());
+                }
+                free_data = [=]() {
+                    free_sized(buffer, size - sizeof(olean_header));
+                };
+                in.read(buffer, size - sizeof(olean_header));
+                if (!in) {
+                    free_data();
+                    return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+                }
+                register_olean_region(external_region{base_addr, size, header.content_hash}, buffer);
+                std::function<void()> free_buffer = free_data;
+                free_data = [=]() {
+                    unregister_olean_region(buffer);
+                    free_buffer();
+                };
             }
         }
         in.close();
 
+        // see file format description above
+        size_t num_ext = data_size >= sizeof(size_t) ? reinterpret_cast<size_t *>(buffer + data_size)[-1] : 0;
+        if (data_size < sizeof(size_t) || num_ext > (data_size / sizeof(size_t) - 1) / 3) {
+            free_data();
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid index of referenced files").str());
+        }
+        data_size -= (3 * num_ext + 1) * sizeof(size_t);
+        size_t const * ext_begin = reinterpret_cast<size_t *>(buffer + data_size);
+        std::vector<external_region> ext_regions;
+        for (size_t i = 0; i < num_ext; i++) {
+            ext_regions.push_back(external_region{reinterpret_cast<char const *>(ext_begin[3*i]), ext_begin[3*i + 1], ext_begin[3*i + 2]});
+        }
+        size_t num_chunks = data_size >= sizeof(size_t) ? reinterpret_cast<size_t *>(buffer + data_size)[-1] : 0;
+        if (data_size < sizeof(size_t) || num_chunks > data_size / sizeof(size_t) - 1) {
+            free_data();
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid chunk index").str());
+        }
+        data_size -= (num_chunks + 1) * sizeof(size_t);
+        size_t const * chunks_begin = reinterpret_cast<size_t *>(buffer + data_size);
+        std::vector<size_t> chunk_offsets(chunks_begin, chunks_begin + num_chunks);
+        size_t prev_off = 0;
+        for (size_t off : chunk_offsets) {
+            if (off < prev_off || off > data_size || off % sizeof(size_t) != 0) {
+                free_data();
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid chunk index").str());
+            }
+            prev_off = off;
+        }
         compacted_region * region =
-          new compacted_region(size - sizeof(olean_header), buffer, base_addr + sizeof(olean_header), is_mmap, free_data);
+          new compacted_region(data_size, buffer, base_addr + sizeof(olean_header), is_mmap, free_data, std::move(chunk_offsets));
+        region->set_external_regions(std::move(ext_regions));
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
@@ -240,6 +517,63 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
     }
 }
 
+/* Check that all .olean files referenced by the given region, see `LEAN_OLEAN_SHARE_IMPORTS`, are loaded
+   with the contents they had when it was written, and resolve the references into them. Its objects may not be
+   accessed otherwise. */
+extern "C" LEAN_EXPORT object * lean_compacted_region_has_valid_external_refs(usize r, object *) {
+    compacted_region * region = reinterpret_cast<compacted_region *>(r);
+    if (region->external_refs_relocated())
+        return io_result_mk_ok(box(true));
+    std::vector<size_t> deltas;
+    bool moved = false;
+    for (external_region const & ext : region->external_regions()) {
+        char const * data = find_olean_region(ext);
+        if (data == nullptr)
+            return io_result_mk_ok(box(false));
+        deltas.push_back(reinterpret_cast<size_t>(data) - reinterpret_cast<size_t>(ext.m_begin + sizeof(olean_header)));
+        moved |= deltas.back() != 0;
+    }
+    // a region relocated by `read` stores its external references in an intermediate form, see `fix_object_ptr`
+    if (deltas.empty() || (!moved && region->is_memory_mapped()))
+        return io_result_mk_ok(box(true));
+    if (region->is_memory_mapped()) {
+#if defined(LEAN_WINDOWS) || !defined(LEAN_MMAP)
+        return io_result_mk_ok(box(false));
+#else
+        // the pages written to are copied as the file is mapped with `MAP_PRIVATE`
+        char * file = static_cast<char *>(region->data()) - sizeof(olean_header);
+        if (mprotect(file, sizeof(olean_header) + region->size(), PROT_READ | PROT_WRITE) != 0)
+            return io_result_mk_ok(box(false));
+#endif
+    }
+    region->relocate_external_refs(deltas);
+    return io_result_mk_ok(box(true));
+}
+
+/* Hint to the OS that the given .olean file will be read soon. This is best effort, so errors are ignored. */
+extern "C" LEAN_EXPORT object * lean_prefetch_module_data(b_obj_arg fname, object *) {
+#ifndef LEAN_WINDOWS
+    int fd = open(string_cstr(fname), O_RDONLY);
+    if (fd != -1) {
+#if defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            struct radvisory ra;
+            ra.ra_offset = 0;
+            ra.ra_count  = static_cast<int>(std::min<off_t>(st.st_size, INT_MAX));
+            fcntl(fd, F_RDADVISE, &ra);
+        }
+#endif
+        close(fd);
+    }
+#else
+    (void)fname;
+#endif
+    return io_result_mk_ok(box(0));
+}
+
 /*
 @[export lean.write_module_core]
 def writeModule (env : Environment) (fname : String) : IO Unit := */
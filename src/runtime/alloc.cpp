@@ -4,16 +4,17 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <vector>
+#include <cstring>
+#include <algorithm>
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
 #include "runtime/alloc.h"
 
-#ifdef LEAN_RUNTIME_STATS
-#define LEAN_RUNTIME_STAT_CODE(c) c
-#else
-#define LEAN_RUNTIME_STAT_CODE(c)
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#include <unistd.h>
+#define LEAN_SEGMENT_MMAP
 #endif
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -23,42 +24,49 @@ Author: Leonardo de Moura
 #endif
 
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
-#define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
+#define LEAN_SEGMENT_SIZE          (8*1024*1024) // 8 Mb
+#define LEAN_PAGES_PER_SEGMENT     (LEAN_SEGMENT_SIZE / LEAN_PAGE_SIZE)
 #define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
-#define LEAN_MAX_TO_EXPORT_OBJS    1024
+/* Objects in (LEAN_MAX_SMALL_OBJECT_SIZE, LEAN_MAX_MEDIUM_OBJECT_SIZE] are allocated in "medium pages"
+   spanning several pages, using four size classes per power of two. */
+#define LEAN_MAX_MEDIUM_OBJECT_SIZE (256*1024)  // 256 Kb
+#define LEAN_NUM_MEDIUM_SLOTS      24
+#define LEAN_MIN_MEDIUM_PAGE_SIZE  (64*1024)    // 64 Kb
+#define LEAN_MIN_MEDIUM_PAGE_OBJS  8
+/* Default number of empty pages a heap keeps for reuse before returning memory to the OS,
+   can be overridden using the `LEAN_RETAINED_PAGES` environment variable. */
+#define LEAN_DEFAULT_RETAINED_PAGES 256 // 2 Mb
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
+LEAN_CASSERT(LEAN_MAX_SMALL_OBJECT_SIZE == 4096); // smallest medium size class is 5 Kb
+LEAN_CASSERT(LEAN_MIN_MEDIUM_PAGE_OBJS * LEAN_MAX_MEDIUM_OBJECT_SIZE <= 256 * LEAN_PAGE_SIZE);
 
 namespace lean {
 
+/* Statistics counter that is only updated by the thread owning it, but may be read concurrently
+   by `get_alloc_stats`. */
+class stat_counter {
+#if defined(LEAN_MULTI_THREAD)
+    atomic<uint64_t> m_value{0};
+    uint64_t get() const { return m_value.load(memory_order_relaxed); }
+    void set(uint64_t v) { m_value.store(v, memory_order_relaxed); }
+#else
+    uint64_t m_value{0};
+    uint64_t get() const { return m_value; }
+    void set(uint64_t v) { m_value = v; }
+#endif
+public:
+    operator uint64_t() const { return get(); }
+    stat_counter & operator+=(uint64_t d) { set(get() + d); return *this; }
+    stat_counter & operator-=(uint64_t d) { set(get() - d); return *this; }
+    void operator++(int) { set(get() + 1); }
+    void operator--(int) { set(get() - 1); }
+};
+
 #ifdef LEAN_SMALL_ALLOCATOR
 
 namespace allocator {
-#ifdef LEAN_RUNTIME_STATS
-static atomic<uint64> g_num_alloc(0);
-static atomic<uint64> g_num_small_alloc(0);
-static atomic<uint64> g_num_dealloc(0);
-static atomic<uint64> g_num_small_dealloc(0);
-static atomic<uint64> g_num_segments(0);
-static atomic<uint64> g_num_pages(0);
-static atomic<uint64> g_num_exports(0);
-static atomic<uint64> g_num_recycled_pages(0);
-struct alloc_stats {
-    ~alloc_stats() {
-        std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
-        std::cerr << "num. small alloc.:   " << g_num_small_alloc << "\n";
-        std::cerr << "num. dealloc.:       " << g_num_dealloc << "\n";
-        std::cerr << "num. small dealloc.: " << g_num_small_dealloc << "\n";
-        std::cerr << "num. segments:       " << g_num_segments << "\n";
-        std::cerr << "num. pages:          " << g_num_pages << "\n";
-        std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
-        std::cerr << "num. exports:        " << g_num_exports << "\n";
-    }
-};
-static alloc_stats g_alloc_stats;
-#endif
-
 struct heap;
 struct page;
 struct page_header {
@@ -71,8 +79,36 @@ struct page_header {
     unsigned         m_num_free;
     unsigned         m_slot_idx;
     bool             m_in_page_free_list;
+    /* Objects of this page deallocated by other heaps. They are moved to `m_free_list` by the
+       owner heap in `heap::import_objs`. */
+    atomic<void *>   m_remote_free_list;
+    /* Next page in the owner's `heap::m_remote_pages` list */
+    page *           m_next_remote;
 };
 
+/* Size class `i` of medium objects is `2^k + j*2^(k-2)` where `k = 12 + i/4` and `j = i%4 + 1`. */
+static inline unsigned get_medium_slot_idx(size_t sz) {
+    lean_assert(sz > LEAN_MAX_SMALL_OBJECT_SIZE && sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE);
+    unsigned k = 63 - __builtin_clzll(sz - 1);
+    size_t base = static_cast<size_t>(1) << k;
+    unsigned j = ((sz - base) * 4 + base - 1) / base;
+    return (k - 12) * 4 + j - 1;
+}
+
+static inline unsigned get_medium_obj_size(unsigned midx) {
+    unsigned k = 12 + midx / 4;
+    return (1u << k) + (midx % 4 + 1) * (1u << (k - 2));
+}
+
+/* Number of pages of a medium page. It is large enough for `LEAN_MIN_MEDIUM_PAGE_OBJS` objects
+   minus the space taken by the page header, and never more than 256 pages. */
+static inline unsigned get_medium_page_num_pages(unsigned midx) {
+    size_t sz = std::max<size_t>(LEAN_MIN_MEDIUM_PAGE_SIZE, LEAN_MIN_MEDIUM_PAGE_OBJS * get_medium_obj_size(midx));
+    return lean_align(sz, LEAN_PAGE_SIZE) / LEAN_PAGE_SIZE;
+}
+
+/* A page containing objects of a single size class. The header of medium pages, which span
+   `get_num_pages()` consecutive pages, is stored in their first page. */
 struct page {
     page_header m_header;
     char        m_data[LEAN_PAGE_SIZE - sizeof(page_header)];
@@ -85,55 +121,218 @@ struct page {
     bool has_many_free() const { return m_header.m_num_free > m_header.m_max_free / 4; }
     bool in_page_free_list() const { return m_header.m_in_page_free_list; }
     unsigned get_slot_idx() const { return m_header.m_slot_idx; }
+    bool is_medium() const { return m_header.m_slot_idx >= LEAN_NUM_SLOTS; }
+    unsigned get_num_pages() const { return is_medium() ? get_medium_page_num_pages(m_header.m_slot_idx - LEAN_NUM_SLOTS) : 1; }
     void push_free_obj(void * o);
 };
 
+static inline page * get_page_of(void * o) {
+    return reinterpret_cast<page*>((reinterpret_cast<size_t>(o)/LEAN_PAGE_SIZE)*LEAN_PAGE_SIZE);
+}
+
 inline char * align_ptr(char * p, size_t a) {
     return reinterpret_cast<char*>(lean_align(reinterpret_cast<size_t>(p), a));
 }
 
+/* A segment is a `LEAN_SEGMENT_SIZE`-aligned memory region owned by a single heap. The segment
+   header occupies its first page, the remaining pages are handed out by `alloc_page`. Pages
+   without any allocated objects are marked as empty and can be reused for any object size. Empty
+   pages may also be decommitted, i.e. their memory is returned to the OS until they are reused. */
 struct segment {
     segment *    m_next{nullptr};
+    segment *    m_prev{nullptr};
     char *       m_next_page_mem;
-    char         m_data[LEAN_SEGMENT_SIZE];
+    /* Whether the segment is backed by huge pages, in which case empty pages are not decommitted
+       as that would split the huge pages */
+    bool         m_huge{false};
+    /* Number of pages handed out so far and how many of them are empty */
+    unsigned     m_num_pages{0};
+    unsigned     m_num_empty{0};
+    uint64_t     m_empty[LEAN_PAGES_PER_SEGMENT / 64];
+    /* Subset of `m_empty` */
+    uint64_t     m_decommitted[LEAN_PAGES_PER_SEGMENT / 64];
+    /* For each page that is part of a medium page, its distance in pages to the first one. */
+    uint8_t      m_page_offset[LEAN_PAGES_PER_SEGMENT];
 
     char * get_first_page_mem() {
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) >= m_data);
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) > reinterpret_cast<char*>(this));
-        return align_ptr(m_data, LEAN_PAGE_SIZE);
+        return reinterpret_cast<char*>(this) + LEAN_PAGE_SIZE;
     }
 
     segment() {
         m_next_page_mem = get_first_page_mem();
+        memset(m_empty, 0, sizeof(m_empty));
+        memset(m_decommitted, 0, sizeof(m_decommitted));
+        memset(m_page_offset, 0, sizeof(m_page_offset));
     }
 
     bool is_full() const {
-        return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
+        return m_next_page_mem + LEAN_PAGE_SIZE > reinterpret_cast<char const *>(this) + LEAN_SEGMENT_SIZE;
+    }
+
+    unsigned get_page_idx(page * p) const {
+        return (reinterpret_cast<char*>(p) - reinterpret_cast<char const *>(this)) / LEAN_PAGE_SIZE;
+    }
+
+    page * get_page(unsigned idx) {
+        return reinterpret_cast<page*>(reinterpret_cast<char*>(this) + idx * LEAN_PAGE_SIZE);
+    }
+
+    unsigned get_num_free_pages() const {
+        return (reinterpret_cast<char const *>(this) + LEAN_SEGMENT_SIZE - m_next_page_mem) / LEAN_PAGE_SIZE;
     }
 };
 
+LEAN_CASSERT(sizeof(segment) <= LEAN_PAGE_SIZE);
+
+static inline segment * get_segment_of(page * p) {
+    return reinterpret_cast<segment*>(reinterpret_cast<size_t>(p) & ~static_cast<size_t>(LEAN_SEGMENT_SIZE - 1));
+}
+
+/* Return the (medium) page containing `o`. */
+static inline page * get_span_of(void * o) {
+    page * p    = get_page_of(o);
+    segment * s = get_segment_of(p);
+    return reinterpret_cast<page*>(reinterpret_cast<char*>(p) - s->m_page_offset[s->get_page_idx(p)] * LEAN_PAGE_SIZE);
+}
+
+static inline bool test_bit(uint64_t const * bits, unsigned i) { return (bits[i / 64] >> (i % 64)) & 1; }
+static inline void set_bit(uint64_t * bits, unsigned i) { bits[i / 64] |= static_cast<uint64_t>(1) << (i % 64); }
+static inline void reset_bit(uint64_t * bits, unsigned i) { bits[i / 64] &= ~(static_cast<uint64_t>(1) << (i % 64)); }
+
+/* Huge page support for segments, selected using the `LEAN_HUGE_PAGES` environment variable:
+   `thp` (or `1`) advises the kernel to back segments with transparent huge pages, `hugetlb` uses
+   pages from the huge page pool and falls back to `thp` when the pool is exhausted. */
+enum class huge_pages_mode { None, THP, HugeTLB };
+static huge_pages_mode g_huge_pages = huge_pages_mode::None;
+
+static void * alloc_segment_memory(bool & huge) {
+    void * r;
+    huge = false;
+#if defined(LEAN_SEGMENT_MMAP)
+    /* Over-allocate so that we can trim the mapping to an aligned region. Note that
+       `LEAN_SEGMENT_SIZE` is a multiple of the usual huge page sizes. */
+    size_t sz = 2 * LEAN_SEGMENT_SIZE;
+    char * m  = static_cast<char*>(MAP_FAILED);
+#if defined(MAP_HUGETLB)
+    if (g_huge_pages == huge_pages_mode::HugeTLB) {
+        m    = static_cast<char*>(mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0));
+        huge = m != MAP_FAILED;
+    }
+#endif
+    if (m == MAP_FAILED)
+        m = static_cast<char*>(mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (m == MAP_FAILED) lean_internal_panic_out_of_memory();
+    char * a = align_ptr(m, LEAN_SEGMENT_SIZE);
+    if (a > m)
+        munmap(m, a - m);
+    if (a + LEAN_SEGMENT_SIZE < m + sz)
+        munmap(a + LEAN_SEGMENT_SIZE, (m + sz) - (a + LEAN_SEGMENT_SIZE));
+#if defined(MADV_HUGEPAGE)
+    if (!huge && g_huge_pages != huge_pages_mode::None)
+        huge = madvise(a, LEAN_SEGMENT_SIZE, MADV_HUGEPAGE) == 0;
+#endif
+    r = a;
+#elif defined(LEAN_WINDOWS)
+    r = _aligned_malloc(LEAN_SEGMENT_SIZE, LEAN_SEGMENT_SIZE);
+#else
+    r = aligned_alloc(LEAN_SEGMENT_SIZE, LEAN_SEGMENT_SIZE);
+#endif
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+    return r;
+}
+
+static void free_segment_memory(void * s) {
+#if defined(LEAN_SEGMENT_MMAP)
+    munmap(s, LEAN_SEGMENT_SIZE);
+#elif defined(LEAN_WINDOWS)
+    _aligned_free(s);
+#else
+    free(s);
+#endif
+}
+
+/* Whether memory of single pages can be returned to the OS, which requires OS pages to be no
+   larger than our pages. */
+static bool g_can_decommit_pages = false;
+
+static void decommit_page_memory(page * p) {
+#if defined(LEAN_SEGMENT_MMAP)
+#if defined(__linux__) || !defined(MADV_FREE)
+    madvise(p, LEAN_PAGE_SIZE, MADV_DONTNEED);
+#else
+    madvise(p, LEAN_PAGE_SIZE, MADV_FREE);
+#endif
+#else
+    (void)p;
+#endif
+}
+
+static unsigned g_max_retained_pages = LEAN_DEFAULT_RETAINED_PAGES;
+/* Set while the process is close to its memory limit, see `release_free_memory`. Pages freed in the
+   meantime are returned to the OS right away. */
+static atomic<bool> g_memory_pressure(false);
+/* Incremented by `release_free_memory`. Every heap releases its empty pages when it notices a new
+   value in `heap::check_release`, as only the owner thread may touch its segments. */
+static atomic<unsigned> g_release_epoch(0);
+
 struct heap {
+    /* List of segments owned by this heap, pages are carved from the first one */
     segment * m_curr_segment{nullptr};
+    /* Number of empty pages in our segments that are still committed, and that are decommitted */
+    stat_counter m_num_empty_pages;
+    stat_counter m_num_decommitted_pages;
+    /* Number of empty committed pages in huge page segments, which are included in `m_num_empty_pages`
+       but are never decommitted individually, see `release_empty_pages` */
+    stat_counter m_num_huge_empty_pages;
+    /* Statistics, see `alloc_stats`. Note that objects are accounted to the heap that allocated
+       them, and large allocations to the heap that allocated or deallocated them. */
+    stat_counter m_num_segments;
+    stat_counter m_num_huge_page_segments;
+    stat_counter m_num_pages;
+    stat_counter m_num_remote_frees;
+    stat_counter m_num_large_allocs;
+    stat_counter m_large_bytes;
+    stat_counter m_num_live_objs[LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS];
+    /* All heaps ever created, see `heap_manager::m_heaps` */
+    heap *    m_next_heap{nullptr};
     heap *    m_next_orphan{nullptr};
-    page *    m_curr_page[LEAN_NUM_SLOTS];
-    page *    m_page_free_list[LEAN_NUM_SLOTS];
-    /* Objects that must be sent to other heaps. */
-    void *    m_to_export_list{nullptr};
-    unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
-    /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+    page *    m_curr_page[LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS];
+    page *    m_page_free_list[LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS];
+    /* Pages with a nonempty `m_remote_free_list`. A page is added by the thread whose deallocation
+       made the list nonempty, and the whole list is taken by `import_objs`. */
+    atomic<page *> m_remote_pages{nullptr};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
+    /* Last value of `g_release_epoch` seen by this heap */
+    unsigned  m_release_epoch{0};
     void import_objs();
-    void export_objs();
     void alloc_segment();
+    void free_segment(segment * s);
+    void free_page(page * p);
+    page * reuse_empty_page();
+    page * reuse_empty_pages(unsigned n);
+    char * alloc_pages(unsigned n);
+    void release_empty_pages(unsigned max_retained);
+    uint64_t num_releasable_empty_pages() const { return m_num_empty_pages - m_num_huge_empty_pages; }
+    void check_release() {
+        unsigned epoch = g_release_epoch.load(std::memory_order_relaxed);
+        if (LEAN_UNLIKELY(epoch != m_release_epoch)) {
+            m_release_epoch = epoch;
+            release_empty_pages(0);
+        }
+    }
 };
 
 struct heap_manager {
-    /* The mutex protects the list of orphan segments. */
+    /* The mutex protects the list of orphan segments and the list of all heaps. */
     mutex             m_mutex;
     heap *            m_orphans{nullptr};
+    heap *            m_heaps{nullptr};
+
+    void register_heap(heap * h) {
+        lock_guard<mutex> lock(m_mutex);
+        h->m_next_heap = m_heaps;
+        m_heaps = h;
+    }
 
     void push_orphan(heap * h) {
         /* TODO(Leo): avoid mutex */
@@ -155,10 +354,6 @@ struct heap_manager {
     }
 };
 
-static inline page * get_page_of(void * o) {
-    return reinterpret_cast<page*>((reinterpret_cast<size_t>(o)/LEAN_PAGE_SIZE)*LEAN_PAGE_SIZE);
-}
-
 LEAN_THREAD_GLOBAL_PTR(page *, g_curr_pages);
 LEAN_THREAD_PTR(heap, g_heap);
 static heap_manager * g_heap_manager = nullptr;
@@ -175,22 +370,23 @@ static inline void page_list_insert(page * & head, page * new_head) {
     if (head)
         head->set_prev(new_head);
     new_head->set_next(head);
+    new_head->set_prev(nullptr);
     head = new_head;
 }
 
 static inline void page_list_remove(page * & head, page * to_remove) {
+    page * next = to_remove->get_next();
     if (head == to_remove) {
         /* First element */
-        head = to_remove->get_next();
-    }
-    page * prev = to_remove->get_prev();
-    lean_assert(prev);
-    if (page * next = to_remove->get_next()) {
-        prev->set_next(next);
-        next->set_prev(prev);
+        head = next;
+        if (next)
+            next->set_prev(nullptr);
     } else {
-        /* Last element */
-        prev->set_next(nullptr);
+        page * prev = to_remove->get_prev();
+        lean_assert(prev);
+        prev->set_next(next);
+        if (next)
+            next->set_prev(prev);
     }
 }
 
@@ -198,108 +394,289 @@ static inline page * page_list_pop(page * & head) {
     lean_assert(head);
     page * r = head;
     head = head->get_next();
+    if (head)
+        head->set_prev(nullptr);
     return r;
 }
 
 void page::push_free_obj(void * o) {
-    lean_assert(get_page_of(o) == this);
+    lean_assert(get_span_of(o) == this);
     set_next_obj(o, m_header.m_free_list);
     m_header.m_free_list = o;
     m_header.m_num_free++;
-    if (!in_page_free_list() && has_many_free()) {
+    if (in_page_free_list()) {
+        if (LEAN_UNLIKELY(m_header.m_num_free == m_header.m_max_free))
+            get_heap()->free_page(this);
+    } else if (has_many_free()) {
         heap * h = get_heap();
         unsigned slot_idx = m_header.m_slot_idx;
         if (this != h->m_curr_page[slot_idx]) {
-            LEAN_RUNTIME_STAT_CODE(g_num_recycled_pages++);
             m_header.m_in_page_free_list = true;
             page_list_remove(h->m_curr_page[slot_idx], this);
             page_list_insert(h->m_page_free_list[slot_idx], this);
+            if (m_header.m_num_free == m_header.m_max_free)
+                h->free_page(this);
         }
     }
 }
 
-void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
+/* Deallocate an object of `p` owned by another heap. */
+static void push_remote_free_obj(page * p, void * o) {
+    void * head = p->m_header.m_remote_free_list.load();
+    do {
+        set_next_obj(o, head);
+    } while (!p->m_header.m_remote_free_list.compare_exchange_strong(head, o));
+    if (head == nullptr) {
+        /* We are the first one since the last `import_objs`, let the owner know about `p`.
+           Note that `p` cannot be in `m_remote_pages` already. */
+        heap * h   = p->get_heap();
+        page * top = h->m_remote_pages.load();
+        do {
+            p->m_header.m_next_remote = top;
+        } while (!h->m_remote_pages.compare_exchange_strong(top, p));
     }
-    while (to_import) {
-        page * p = get_page_of(to_import);
-        void * n = get_next_obj(to_import);
-        p->push_free_obj(to_import);
-        to_import = n;
+}
+
+void heap::import_objs() {
+    page * p = m_remote_pages.exchange(nullptr);
+    while (p) {
+        /* `p` may be added to `m_remote_pages` again as soon as we take its objects */
+        page * next = p->m_header.m_next_remote;
+        void * o    = p->m_header.m_remote_free_list.exchange(nullptr);
+        stat_counter & num_live = m_num_live_objs[p->get_slot_idx()];
+        while (o) {
+            void * n = get_next_obj(o);
+            num_live--;
+            p->push_free_obj(o);
+            o = n;
+        }
+        p = next;
     }
 }
 
-struct export_entry {
-    heap * m_heap;
-    void * m_head;
-    void * m_tail;
-};
+void heap::alloc_segment() {
+    m_num_segments++;
+    bool huge;
+    segment * s = new (alloc_segment_memory(huge)) segment();
+    s->m_huge   = huge;
+    if (huge)
+        m_num_huge_page_segments++;
+    s->m_next   = m_curr_segment;
+    if (m_curr_segment)
+        m_curr_segment->m_prev = s;
+    m_curr_segment = s;
+}
+
+/* Return the memory of a segment that contains only empty pages to the OS. */
+void heap::free_segment(segment * s) {
+    lean_assert(s != m_curr_segment);
+    lean_assert(s->m_num_empty == s->m_num_pages);
+    m_num_segments--;
+    if (s->m_huge)
+        m_num_huge_page_segments--;
+    unsigned num_decommitted = 0;
+    for (uint64_t bits : s->m_decommitted)
+        num_decommitted += __builtin_popcountll(bits);
+    m_num_empty_pages       -= s->m_num_empty - num_decommitted;
+    m_num_decommitted_pages -= num_decommitted;
+    if (s->m_huge)
+        m_num_huge_empty_pages -= s->m_num_empty - num_decommitted;
+    s->m_prev->m_next = s->m_next;
+    if (s->m_next)
+        s->m_next->m_prev = s->m_prev;
+    s->~segment();
+    free_segment_memory(s);
+}
 
-void heap::export_objs() {
-    std::vector<export_entry> to_export;
-    void * o = m_to_export_list;
-    while (o != nullptr) {
-        void * n   = get_next_obj(o);
-        heap * h   = get_page_of(o)->get_heap();
-        bool found = false;
-        for (export_entry & e : to_export) {
-            if (e.m_heap == h) {
-                set_next_obj(o, e.m_head);
-                e.m_head = o;
-                found = true;
-                break;
+/* `p` does not contain any allocated objects anymore. */
+void heap::free_page(page * p) {
+    lean_assert(p->get_heap() == this);
+    lean_assert(p->in_page_free_list());
+    page_list_remove(m_page_free_list[p->get_slot_idx()], p);
+    p->m_header.m_in_page_free_list = false;
+    segment * s  = get_segment_of(p);
+    unsigned idx = s->get_page_idx(p);
+    unsigned n   = p->get_num_pages();
+    for (unsigned i = idx; i < idx + n; i++) {
+        lean_assert(!test_bit(s->m_empty, i));
+        set_bit(s->m_empty, i);
+        s->m_page_offset[i] = 0;
+    }
+    s->m_num_empty    += n;
+    m_num_pages       -= n;
+    if (g_memory_pressure && g_can_decommit_pages && !s->m_huge) {
+        for (unsigned i = idx; i < idx + n; i++) {
+            decommit_page_memory(s->get_page(i));
+            set_bit(s->m_decommitted, i);
+        }
+        m_num_decommitted_pages += n;
+        return;
+    }
+    m_num_empty_pages += n;
+    if (s->m_huge)
+        m_num_huge_empty_pages += n;
+    else if (num_releasable_empty_pages() > g_max_retained_pages)
+        release_empty_pages(g_max_retained_pages / 2);
+}
+
+/* Return memory of empty pages to the OS until at most `max_retained` of them are left. Segments
+   that consist only of empty pages are released first. Empty pages in huge page segments that are
+   still in use do not count towards `max_retained`, as we cannot release them. */
+void heap::release_empty_pages(unsigned max_retained) {
+    segment * s = m_curr_segment->m_next;
+    while (s && num_releasable_empty_pages() > max_retained) {
+        segment * next = s->m_next;
+        if (s->m_num_empty == s->m_num_pages)
+            free_segment(s);
+        s = next;
+    }
+    if (!g_can_decommit_pages)
+        return;
+    for (s = m_curr_segment; s && num_releasable_empty_pages() > max_retained; s = s->m_next) {
+        if (s->m_huge)
+            continue;
+        for (unsigned i = 0; i < LEAN_PAGES_PER_SEGMENT / 64 && num_releasable_empty_pages() > max_retained; i++) {
+            uint64_t bits = s->m_empty[i] & ~s->m_decommitted[i];
+            while (bits && num_releasable_empty_pages() > max_retained) {
+                unsigned idx = i * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                decommit_page_memory(s->get_page(idx));
+                set_bit(s->m_decommitted, idx);
+                m_num_empty_pages--;
+                m_num_decommitted_pages++;
             }
         }
-        if (!found) {
-            set_next_obj(o, nullptr);
-            to_export.push_back(export_entry{h, o, o});
+    }
+}
+
+/* Take an empty page for reuse, preferring pages that have not been decommitted. */
+page * heap::reuse_empty_page() {
+    bool decommitted = m_num_empty_pages == 0;
+    if (decommitted && m_num_decommitted_pages == 0)
+        return nullptr;
+    for (segment * s = m_curr_segment; s; s = s->m_next) {
+        if (s->m_num_empty == 0)
+            continue;
+        for (unsigned i = 0; i < LEAN_PAGES_PER_SEGMENT / 64; i++) {
+            uint64_t bits = decommitted ? s->m_empty[i] : s->m_empty[i] & ~s->m_decommitted[i];
+            if (bits) {
+                unsigned idx = i * 64 + __builtin_ctzll(bits);
+                reset_bit(s->m_empty, idx);
+                s->m_num_empty--;
+                if (test_bit(s->m_decommitted, idx)) {
+                    reset_bit(s->m_decommitted, idx);
+                    m_num_decommitted_pages--;
+                } else {
+                    m_num_empty_pages--;
+                    if (s->m_huge)
+                        m_num_huge_empty_pages--;
+                }
+                return s->get_page(idx);
+            }
         }
-        o = n;
     }
-    m_to_export_list      = nullptr;
-    m_to_export_list_size = 0;
-    for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
+    lean_unreachable();
+}
+
+/* Take `n > 1` consecutive empty pages for reuse. */
+page * heap::reuse_empty_pages(unsigned n) {
+    if (m_num_empty_pages + m_num_decommitted_pages < n)
+        return nullptr;
+    for (segment * s = m_curr_segment; s; s = s->m_next) {
+        if (s->m_num_empty < n)
+            continue;
+        unsigned run = 0;
+        for (unsigned idx = 1; idx <= s->m_num_pages; idx++) {
+            if (!test_bit(s->m_empty, idx)) {
+                run = 0;
+                continue;
+            }
+            if (++run < n)
+                continue;
+            unsigned first = idx + 1 - n;
+            for (unsigned i = first; i <= idx; i++) {
+                reset_bit(s->m_empty, i);
+                if (test_bit(s->m_decommitted, i)) {
+                    reset_bit(s->m_decommitted, i);
+                    m_num_decommitted_pages--;
+                } else {
+                    m_num_empty_pages--;
+                    if (s->m_huge)
+                        m_num_huge_empty_pages--;
+                }
+            }
+            s->m_num_empty -= n;
+            return s->get_page(first);
+        }
     }
+    return nullptr;
 }
 
-void heap::alloc_segment() {
-    LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-    segment * s = new segment();
-    s->m_next   = m_curr_segment;
-    m_curr_segment = s;
+/* Return memory for `n` consecutive pages. */
+char * heap::alloc_pages(unsigned n) {
+    if (page * e = n == 1 ? reuse_empty_page() : reuse_empty_pages(n))
+        return reinterpret_cast<char*>(e);
+    segment * s = m_curr_segment;
+    if (s->get_num_free_pages() < n) {
+        /* Not enough room left for a medium page, the remaining pages can still be reused by
+           smaller ones. */
+        while (!s->is_full()) {
+            unsigned idx = s->get_page_idx(reinterpret_cast<page*>(s->m_next_page_mem));
+            set_bit(s->m_empty, idx);
+            s->m_next_page_mem += LEAN_PAGE_SIZE;
+            s->m_num_pages++;
+            s->m_num_empty++;
+            m_num_empty_pages++;
+            if (s->m_huge)
+                m_num_huge_empty_pages++;
+        }
+        alloc_segment();
+        s = m_curr_segment;
+    }
+    char * r = s->m_next_page_mem;
+    s->m_next_page_mem += n * LEAN_PAGE_SIZE;
+    s->m_num_pages     += n;
+    if (s->is_full()) {
+        /* s is full, we need to allocate a new one. */
+        alloc_segment();
+    }
+    return r;
 }
 
+/* Allocate a page for objects of size `obj_size`, which is a medium page if `obj_size > LEAN_MAX_SMALL_OBJECT_SIZE`. */
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
-    segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
-    page * p    = new (s->m_next_page_mem) page();
-    s->m_next_page_mem += LEAN_PAGE_SIZE;
-    if (s->is_full()) {
-        /* s is full, we need to allocate a new one. */
-        h->alloc_segment();
+    unsigned slot_idx, num_pages;
+    if (obj_size <= LEAN_MAX_SMALL_OBJECT_SIZE) {
+        slot_idx  = lean_get_slot_idx(obj_size);
+        num_pages = 1;
+    } else {
+        unsigned midx = get_medium_slot_idx(obj_size);
+        lean_assert(get_medium_obj_size(midx) == obj_size);
+        slot_idx  = LEAN_NUM_SLOTS + midx;
+        num_pages = get_medium_page_num_pages(midx);
+    }
+    page * p                 = new (h->alloc_pages(num_pages)) page();
+    h->m_num_pages          += num_pages;
+    if (num_pages > 1) {
+        segment * s  = get_segment_of(p);
+        unsigned idx = s->get_page_idx(p);
+        for (unsigned i = 1; i < num_pages; i++)
+            s->m_page_offset[idx + i] = i;
     }
-    unsigned slot_idx        = lean_get_slot_idx(obj_size);
     p->m_header.m_heap       = h;
     page_list_insert(h->m_curr_page[slot_idx], p);
     p->m_header.m_slot_idx   = slot_idx;
     p->m_header.m_obj_size   = obj_size;
     char * curr_free         = p->m_data;
     set_next_obj(curr_free, nullptr);
-    char * end               = p->m_data + (LEAN_PAGE_SIZE - sizeof(page_header));
+    char * end               = p->m_data + (num_pages * LEAN_PAGE_SIZE - sizeof(page_header));
     unsigned num_free        = 1;
     char * next_free         = curr_free + obj_size;
     while (true) {
         if (next_free + obj_size > end)
             break; /* next object doesn't fit */
-        lean_assert(get_page_of(curr_free) == p);
+        lean_assert(get_span_of(curr_free) == p);
         set_next_obj(next_free, curr_free);
         curr_free = next_free;
         next_free = next_free + obj_size;
@@ -323,7 +700,6 @@ static page * alloc_page(heap * h, unsigned obj_size) {
 
 static void finalize_heap(void * _h) {
     heap * h = static_cast<heap*>(_h);
-    h->export_objs();
     h->import_objs();
     g_heap_manager->push_orphan(h);
 }
@@ -336,8 +712,9 @@ static void init_heap(bool main) {
         g_heap = h;
     } else {
         g_heap = new heap();
+        g_heap_manager->register_heap(g_heap);
         g_curr_pages = g_heap->m_curr_page;
-        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+        for (unsigned i = 0; i < LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS; i++) {
             g_heap->m_curr_page[i] = nullptr;
             g_heap->m_page_free_list[i] = nullptr;
         }
@@ -362,11 +739,12 @@ void init_thread_heap() {
 
 LEAN_NOINLINE
 void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
+    g_heap->check_release();
     if (g_heap->m_page_free_list[slot_idx] == nullptr) {
         g_heap->import_objs();
         lean_assert(g_heap->m_curr_page[slot_idx] == p);
         /* g_heap->import_objs() may add objects to p->m_header.m_free_list */
-        if (p->m_header.m_free_list == nullptr)
+        if (p == nullptr || p->m_header.m_free_list == nullptr)
             p = alloc_page(g_heap, sz);
     } else {
         p = page_list_pop(g_heap->m_page_free_list[slot_idx]);
@@ -377,13 +755,30 @@ void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
     lean_assert(r);
     p->m_header.m_free_list = get_next_obj(r);
     p->m_header.m_num_free--;
-    lean_assert(get_page_of(r) == p);
+    lean_assert(get_span_of(r) == p);
+    return r;
+}
+
+static void * alloc_medium(unsigned sz) {
+    unsigned midx     = get_medium_slot_idx(sz);
+    unsigned slot_idx = LEAN_NUM_SLOTS + midx;
+    g_heap->m_num_live_objs[slot_idx]++;
+    page * p          = g_heap->m_curr_page[slot_idx];
+    void * r          = p ? p->m_header.m_free_list : nullptr;
+    if (r == nullptr) {
+        /* Medium pages are created on demand, so `p` may be `nullptr` */
+        return lean_alloc_small_cold(get_medium_obj_size(midx), slot_idx, p);
+    }
+    p->m_header.m_free_list = get_next_obj(r);
+    p->m_header.m_num_free--;
+    lean_assert(get_span_of(r) == p);
     return r;
 }
 
 extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     page * p = g_heap->m_curr_page[slot_idx];
     g_heap->m_heartbeat++;
+    g_heap->m_num_live_objs[slot_idx]++;
     void * r = p->m_header.m_free_list;
     if (LEAN_UNLIKELY(r == nullptr)) {
         return lean_alloc_small_cold(sz, slot_idx, p);
@@ -394,49 +789,83 @@ extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     return r;
 }
 
+void release_free_memory() {
+    g_memory_pressure = true;
+    unsigned epoch = ++g_release_epoch;
+    if (g_heap) {
+        g_heap->m_release_epoch = epoch;
+        g_heap->release_empty_pages(0);
+    }
+    /* Nobody else uses the heaps of finished threads until they are popped from `m_orphans` */
+    lock_guard<mutex> lock(g_heap_manager->m_mutex);
+    for (heap * h = g_heap_manager->m_orphans; h; h = h->m_next_orphan) {
+        h->m_release_epoch = epoch;
+        h->release_empty_pages(0);
+    }
+}
+
+void reset_memory_pressure() {
+    g_memory_pressure = false;
+}
+
 void * alloc(size_t sz) {
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
-    LEAN_RUNTIME_STAT_CODE(g_num_alloc++);
+    lean_assert(g_heap);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
+        if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+            return alloc_medium(sz);
+        g_heap->m_num_large_allocs++;
+        g_heap->m_large_bytes += sz;
         void * r = malloc(sz);
         if (r == nullptr) lean_internal_panic_out_of_memory();
         return r;
     }
-    lean_assert(g_heap);
-    LEAN_RUNTIME_STAT_CODE(g_num_small_alloc++);
     unsigned slot_idx = lean_get_slot_idx(sz);
     return lean_alloc_small(sz, slot_idx);
 }
 
 LEAN_NOINLINE
-static void dealloc_small_core_cold(void * o) {
-    set_next_obj(o, g_heap->m_to_export_list);
-    g_heap->m_to_export_list = o;
-    g_heap->m_to_export_list_size++;
-    if (g_heap->m_to_export_list_size > LEAN_MAX_TO_EXPORT_OBJS) {
-        LEAN_RUNTIME_STAT_CODE(g_num_exports++);
-        g_heap->export_objs();
-    }
+static void dealloc_small_core_cold(page * p, void * o) {
+    g_heap->m_num_remote_frees++;
+    push_remote_free_obj(p, o);
 }
 
 static inline void dealloc_small_core(void * o) {
-    LEAN_RUNTIME_STAT_CODE(g_num_small_dealloc++);
     if (LEAN_UNLIKELY(g_heap == nullptr)) {
         init_heap(false);
     }
     lean_assert(g_heap);
     page * p = get_page_of(o);
     if (LEAN_LIKELY(p->get_heap() == g_heap)) {
+        g_heap->m_num_live_objs[p->get_slot_idx()]--;
         p->push_free_obj(o);
     } else {
-        dealloc_small_core_cold(o);
+        dealloc_small_core_cold(p, o);
+    }
+}
+
+static void dealloc_medium_core(void * o) {
+    if (LEAN_UNLIKELY(g_heap == nullptr)) {
+        init_heap(false);
+    }
+    page * p = get_span_of(o);
+    if (LEAN_LIKELY(p->get_heap() == g_heap)) {
+        g_heap->m_num_live_objs[p->get_slot_idx()]--;
+        p->push_free_obj(o);
+    } else {
+        dealloc_small_core_cold(p, o);
     }
 }
 
 void dealloc(void * o, size_t sz) {
-    LEAN_RUNTIME_STAT_CODE(g_num_dealloc++);
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
+        if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+            return dealloc_medium_core(o);
+        if (LEAN_UNLIKELY(g_heap == nullptr)) {
+            init_heap(false);
+        }
+        g_heap->m_large_bytes -= sz;
         return free_sized(o, sz);
     }
     dealloc_small_core(o);
@@ -451,18 +880,167 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
     return p->m_header.m_obj_size;
 }
 
+alloc_stats get_alloc_stats() {
+    alloc_stats r;
+    uint64_t live_objs[LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS] = {};
+    {
+        lock_guard<mutex> lock(g_heap_manager->m_mutex);
+        for (heap * h = g_heap_manager->m_heaps; h; h = h->m_next_heap) {
+            r.m_num_heaps++;
+            r.m_num_segments          += h->m_num_segments;
+            r.m_num_huge_page_segments += h->m_num_huge_page_segments;
+            r.m_num_pages             += h->m_num_pages;
+            r.m_num_empty_pages       += h->m_num_empty_pages;
+            r.m_num_decommitted_pages += h->m_num_decommitted_pages;
+            r.m_num_remote_frees      += h->m_num_remote_frees;
+            r.m_num_large_allocs      += h->m_num_large_allocs;
+            r.m_large_bytes           += h->m_large_bytes;
+            for (unsigned i = 0; i < LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS; i++)
+                live_objs[i] += h->m_num_live_objs[i];
+        }
+    }
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS + LEAN_NUM_MEDIUM_SLOTS; i++) {
+        /* Counters of different heaps may temporarily not add up while other threads are running */
+        if (static_cast<int64_t>(live_objs[i]) > 0) {
+            unsigned obj_size = i < LEAN_NUM_SLOTS ? (i + 1) * LEAN_OBJECT_SIZE_DELTA : get_medium_obj_size(i - LEAN_NUM_SLOTS);
+            r.m_live_objs.emplace_back(obj_size, live_objs[i]);
+        }
+    }
+    return r;
+}
+
+#endif
+
+#ifndef LEAN_SMALL_ALLOCATOR
+void release_free_memory() {
+}
+
+void reset_memory_pressure() {
+}
+
+/* Without the small object allocator, small objects are allocated using mimalloc or `malloc`. With
+   `LEAN_ALLOC_STATS`, each thread counts the small objects it allocates and deallocates, see
+   `lean_alloc_small_object` and `lean_free_small_object`; the counting is compiled out of these
+   inline functions otherwise. An object deallocated by another thread is subtracted from that
+   thread's counters, so only the sum over all threads is meaningful. */
+struct thread_alloc_counters {
+    stat_counter            m_num_live_objs[LEAN_NUM_SLOTS];
+    thread_alloc_counters * m_next{nullptr};
+    thread_alloc_counters * m_next_orphan{nullptr};
+};
+
+/* All counters ever created, and the ones of finished threads that can be reused */
+struct alloc_counters_manager {
+    mutex                   m_mutex;
+    thread_alloc_counters * m_counters{nullptr};
+    thread_alloc_counters * m_orphans{nullptr};
+};
+
+static alloc_counters_manager * g_alloc_counters_manager = nullptr;
+LEAN_THREAD_PTR(thread_alloc_counters, g_alloc_counters);
+
+static void finalize_alloc_counters(void * _c) {
+    thread_alloc_counters * c = static_cast<thread_alloc_counters*>(_c);
+    lock_guard<mutex> lock(g_alloc_counters_manager->m_mutex);
+    c->m_next_orphan = g_alloc_counters_manager->m_orphans;
+    g_alloc_counters_manager->m_orphans = c;
+}
+
+LEAN_NOINLINE
+static thread_alloc_counters * init_alloc_counters(bool main) {
+    lean_assert(g_alloc_counters == nullptr);
+    {
+        lock_guard<mutex> lock(g_alloc_counters_manager->m_mutex);
+        if (thread_alloc_counters * c = g_alloc_counters_manager->m_orphans) {
+            g_alloc_counters_manager->m_orphans = c->m_next_orphan;
+            g_alloc_counters = c;
+        } else {
+            g_alloc_counters = new thread_alloc_counters();
+            g_alloc_counters->m_next = g_alloc_counters_manager->m_counters;
+            g_alloc_counters_manager->m_counters = g_alloc_counters;
+        }
+    }
+    if (!main)
+        register_thread_finalizer(finalize_alloc_counters, g_alloc_counters);
+    return g_alloc_counters;
+}
+
+static inline thread_alloc_counters * get_alloc_counters() {
+    thread_alloc_counters * c = g_alloc_counters;
+    if (LEAN_UNLIKELY(c == nullptr))
+        c = init_alloc_counters(false);
+    return c;
+}
+
+extern "C" LEAN_EXPORT void lean_small_object_allocated(unsigned sz) {
+    add_heartbeats(1);
+    if (sz > 0 && sz <= LEAN_MAX_SMALL_OBJECT_SIZE)
+        get_alloc_counters()->m_num_live_objs[lean_get_slot_idx(lean_align(sz, LEAN_OBJECT_SIZE_DELTA))]++;
+}
+
+extern "C" LEAN_EXPORT void lean_small_object_freed(unsigned sz) {
+    /* Objects allocated with `lean_alloc_object` have size 0 when using mimalloc */
+    if (sz > 0 && sz <= LEAN_MAX_SMALL_OBJECT_SIZE)
+        get_alloc_counters()->m_num_live_objs[lean_get_slot_idx(lean_align(sz, LEAN_OBJECT_SIZE_DELTA))]--;
+}
+
+alloc_stats get_alloc_stats() {
+    alloc_stats r;
+    uint64_t live_objs[LEAN_NUM_SLOTS] = {};
+    {
+        lock_guard<mutex> lock(g_alloc_counters_manager->m_mutex);
+        for (thread_alloc_counters * c = g_alloc_counters_manager->m_counters; c; c = c->m_next)
+            for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++)
+                live_objs[i] += c->m_num_live_objs[i];
+    }
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+        /* Counters of different threads may temporarily not add up while other threads are running */
+        if (static_cast<int64_t>(live_objs[i]) > 0)
+            r.m_live_objs.emplace_back((i + 1) * LEAN_OBJECT_SIZE_DELTA, live_objs[i]);
+    }
+    return r;
+}
 #endif
 
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+#if defined(LEAN_SEGMENT_MMAP)
+    g_can_decommit_pages = sysconf(_SC_PAGESIZE) <= LEAN_PAGE_SIZE;
+#endif
+    if (char const * n = std::getenv("LEAN_RETAINED_PAGES"))
+        g_max_retained_pages = atoi(n);
+    if (char const * m = std::getenv("LEAN_HUGE_PAGES")) {
+        if (strcmp(m, "hugetlb") == 0)
+            g_huge_pages = huge_pages_mode::HugeTLB;
+        else if (strcmp(m, "thp") == 0 || strcmp(m, "1") == 0)
+            g_huge_pages = huge_pages_mode::THP;
+    }
     g_heap_manager = new heap_manager();
     init_heap(true);
+#else
+    g_alloc_counters_manager = new alloc_counters_manager();
+    init_alloc_counters(true);
 #endif
 }
 
 void finalize_alloc() {
 }
 
+void display_alloc_stats(std::ostream & out) {
+    alloc_stats s = get_alloc_stats();
+    out << "allocator heaps:                       " << s.m_num_heaps << "\n";
+    out << "allocator segments:                    " << s.m_num_segments << "\n";
+    out << "huge page segments:                    " << s.m_num_huge_page_segments << "\n";
+    out << "allocator pages:                       " << s.m_num_pages << "\n";
+    out << "empty allocator pages:                 " << s.m_num_empty_pages << "\n";
+    out << "decommitted allocator pages:           " << s.m_num_decommitted_pages << "\n";
+    out << "remote frees:                          " << s.m_num_remote_frees << "\n";
+    out << "large allocations:                     " << s.m_num_large_allocs << "\n";
+    out << "large allocation bytes:                " << static_cast<int64_t>(s.m_large_bytes) << "\n";
+    for (auto const & p : s.m_live_objs)
+        out << "live objects of size " << p.first << ": " << p.second << "\n";
+}
+
 #ifndef LEAN_SMALL_ALLOCATOR
 LEAN_THREAD_VALUE(uint64_t, g_heartbeat, 0);
 #endif
@@ -7,15 +7,47 @@ Author: Leonardo de Moura
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <iosfwd>
+#include <utility>
+#include <vector>
 #include <lean/lean.h>
 
 namespace lean {
+/* Statistics of the small object allocator, aggregated over all thread heaps. If the runtime was
+   compiled without `LEAN_SMALL_ALLOCATOR`, e.g. when using mimalloc, only `m_live_objs` is
+   available, and only with `LEAN_ALLOC_STATS`; all other fields are zero. */
+struct alloc_stats {
+    /* Number of thread heaps, including heaps of finished threads that are waiting for reuse */
+    uint64_t m_num_heaps{0};
+    uint64_t m_num_segments{0};
+    uint64_t m_num_huge_page_segments{0};
+    /* Number of pages containing objects, and of empty pages that are committed or decommitted */
+    uint64_t m_num_pages{0};
+    uint64_t m_num_empty_pages{0};
+    uint64_t m_num_decommitted_pages{0};
+    /* Number of objects deallocated by a thread other than the one that allocated them */
+    uint64_t m_num_remote_frees{0};
+    /* Allocations too big for the small object allocator, which are delegated to `malloc` */
+    uint64_t m_num_large_allocs{0};
+    uint64_t m_large_bytes{0};
+    /* For each size class with live objects, the object size and the number of live objects.
+       Objects deallocated by other threads are live until their owner collects them. */
+    std::vector<std::pair<unsigned, uint64_t>> m_live_objs;
+};
+LEAN_EXPORT alloc_stats get_alloc_stats();
+LEAN_EXPORT void display_alloc_stats(std::ostream & out);
 void init_thread_heap();
 LEAN_EXPORT void * alloc(size_t sz);
 LEAN_EXPORT void dealloc(void * o, size_t sz);
 LEAN_EXPORT void set_heartbeats(uint64_t count);
 LEAN_EXPORT void add_heartbeats(uint64_t count);
 LEAN_EXPORT uint64_t get_num_heartbeats();
+/* Return as much unused memory to the OS as possible, and make all heaps return pages as soon as
+   they become empty until `reset_memory_pressure` is called. The heaps of the current thread and of
+   finished threads are released right away, the ones of other threads on their next allocation
+   slow path. Used when approaching the memory limit. */
+LEAN_EXPORT void release_free_memory();
+LEAN_EXPORT void reset_memory_pressure();
 void initialize_alloc();
 void finalize_alloc();
 }
@@ -4,13 +4,13 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <unordered_set>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
 #include <lean/lean.h>
 #include "runtime/hash.h"
+#include "runtime/thread.h"
 #include "runtime/compact.h"
 
 #ifndef LEAN_WINDOWS
@@ -18,50 +18,211 @@ Author: Leonardo de Moura
 #endif
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
-#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
+#define LEAN_COMPACTED_CHUNK_SIZE 1024*1024
+// log2 of the initial capacity of `object_compactor::obj_table` and `object_compactor::max_sharing_table`
+#define LEAN_COMPACTOR_TABLE_INIT_LOG_SZ 16
+// minimum number of sections per partition in `object_compactor::compact_parallel`
+#define LEAN_COMPACTOR_MIN_PARTITION_SECTIONS 64
+// log2 of the number of shards of `object_compactor::owner_table`, and of the initial capacity of each shard
+#define LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARDS 8
+#define LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARD_SZ 10
 
 // uncomment to track the number of each kind of object in an .olean file
 // #define LEAN_TAG_COUNTERS
 
 namespace lean {
 
-struct max_sharing_key {
-    size_t m_offset;
-    size_t m_size;
-    max_sharing_key(size_t offset, size_t sz):m_offset(offset), m_size(sz) {}
-};
+static inline size_t table_index(uint64 h, unsigned shift) {
+    return static_cast<size_t>((h * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+/* Open-addressing hash table with linear probing from objects to their offsets in the compacted region.
+   Objects are never removed, so we do not need tombstones. */
+struct object_compactor::obj_table {
+    struct entry {
+        object *      m_obj;
+        object_offset m_offset;
+    };
+    std::vector<entry> m_entries;
+    unsigned m_shift;
+    size_t m_size = 0;
+
+    explicit obj_table(unsigned log_capacity):
+        m_entries(static_cast<size_t>(1) << log_capacity), m_shift(64 - log_capacity) {}
 
-struct max_sharing_hash {
-    object_compactor * m;
-    max_sharing_hash(object_compactor * manager):m(manager) {}
-    unsigned operator()(max_sharing_key const & k) const {
-        return hash_str(k.m_size, reinterpret_cast<unsigned char const *>(m->m_begin) + k.m_offset, 17);
+    object_offset const * find(object * o) const {
+        size_t mask = m_entries.size() - 1;
+        for (size_t i = table_index(reinterpret_cast<size_t>(o), m_shift);; i = (i + 1) & mask) {
+            entry const & e = m_entries[i];
+            if (e.m_obj == o)
+                return &e.m_offset;
+            if (e.m_obj == nullptr)
+                return nullptr;
+        }
+    }
+
+    /* `o` must not be in the table yet. */
+    void insert(object * o, object_offset offset) {
+        if (2 * (m_size + 1) > m_entries.size())
+            grow(2 * (m_size + 1));
+        size_t mask = m_entries.size() - 1;
+        size_t i = table_index(reinterpret_cast<size_t>(o), m_shift);
+        while (m_entries[i].m_obj != nullptr)
+            i = (i + 1) & mask;
+        m_entries[i] = entry{o, offset};
+        m_size++;
     }
-};
 
-struct max_sharing_eq {
-    object_compactor * m;
-    max_sharing_eq(object_compactor * manager):m(manager) {}
-    bool operator()(max_sharing_key const & k1, max_sharing_key const & k2) const {
-        if (k1.m_size != k2.m_size) return false;
-        return memcmp(reinterpret_cast<char*>(m->m_begin) + k1.m_offset, reinterpret_cast<char*>(m->m_begin) + k2.m_offset, k1.m_size) == 0;
+    /* Make room for `n` entries without rehashing. */
+    void grow(size_t n) {
+        if (2 * n <= m_entries.size())
+            return;
+        unsigned log_capacity = 64 - m_shift;
+        while ((static_cast<size_t>(1) << log_capacity) < 2 * n)
+            log_capacity++;
+        std::vector<entry> old(static_cast<size_t>(1) << log_capacity);
+        old.swap(m_entries);
+        m_shift = 64 - log_capacity;
+        size_t mask = m_entries.size() - 1;
+        for (entry const & e : old) {
+            if (e.m_obj == nullptr)
+                continue;
+            size_t i = table_index(reinterpret_cast<size_t>(e.m_obj), m_shift);
+            while (m_entries[i].m_obj != nullptr)
+                i = (i + 1) & mask;
+            m_entries[i] = e;
+        }
     }
 };
 
+/* Concurrent map from objects to the index of the first partition in `compact_parallel` that reached them,
+   shared by the compactors of all partitions. It is sharded by the top bits of the hash of the address, and each
+   shard is an open-addressing table like `obj_table` indexed by the following bits. */
+struct object_compactor::owner_table {
+    struct entry {
+        object * m_obj;
+        size_t   m_part;
+    };
+    struct shard {
+        mutex              m_mutex;
+        std::vector<entry> m_entries;
+        unsigned           m_shift = 64 - LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARD_SZ;
+        size_t             m_size = 0;
+        shard(): m_entries(static_cast<size_t>(1) << LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARD_SZ) {}
+
+        size_t slot(uint64 h) const { return static_cast<size_t>((h << LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARDS) >> m_shift); }
+
+        void grow() {
+            std::vector<entry> old(2 * m_entries.size());
+            old.swap(m_entries);
+            m_shift--;
+            size_t mask = m_entries.size() - 1;
+            for (entry const & e : old) {
+                if (e.m_obj == nullptr)
+                    continue;
+                size_t i = slot(reinterpret_cast<size_t>(e.m_obj) * 0x9E3779B97F4A7C15ull);
+                while (m_entries[i].m_obj != nullptr)
+                    i = (i + 1) & mask;
+                m_entries[i] = e;
+            }
+        }
+    };
+    shard m_shards[static_cast<size_t>(1) << LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARDS];
+    /* Set when a partition reaches a thunk or task, see `compact_parallel`. */
+    atomic<bool> m_abort{false};
+
+    /* Record that partition `part` reached `o`, and return the smallest index of a partition that did so. */
+    size_t claim(object * o, size_t part) {
+        uint64 h = reinterpret_cast<size_t>(o) * 0x9E3779B97F4A7C15ull;
+        shard & s = m_shards[h >> (64 - LEAN_COMPACTOR_OWNER_TABLE_LOG_SHARDS)];
+        lock_guard<mutex> lock(s.m_mutex);
+        if (2 * (s.m_size + 1) > s.m_entries.size())
+            s.grow();
+        size_t mask = s.m_entries.size() - 1;
+        for (size_t i = s.slot(h);; i = (i + 1) & mask) {
+            entry & e = s.m_entries[i];
+            if (e.m_obj == o) {
+                if (part < e.m_part)
+                    e.m_part = part;
+                return e.m_part;
+            }
+            if (e.m_obj == nullptr) {
+                e = entry{o, part};
+                s.m_size++;
+                return part;
+            }
+        }
+    }
+};
 
+/* Open-addressing hash set of compacted objects by their contents, used by `save_max_sharing`. Objects are
+   identified by their offset and size in the compacted region, and we store the hash of their contents so
+   that it is computed exactly once per object. Offset 0 is the root address, so it marks empty entries. */
 struct object_compactor::max_sharing_table {
-    std::unordered_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
-    max_sharing_table(object_compactor * manager):
-        m_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, max_sharing_hash(manager), max_sharing_eq(manager)) {
+    struct entry {
+        size_t m_offset;
+        size_t m_size;
+        uint64 m_hash;
+    };
+    std::vector<entry> m_entries;
+    unsigned m_shift;
+    size_t m_size = 0;
+
+    explicit max_sharing_table(unsigned log_capacity):
+        m_entries(static_cast<size_t>(1) << log_capacity), m_shift(64 - log_capacity) {}
+
+    /* Return the offset of an object with the same contents as the `sz` bytes at `offset` in the region
+       starting at `begin`, or insert the latter and return 0 if there is none. */
+    size_t find_or_insert(char const * begin, size_t offset, size_t sz) {
+        if (2 * (m_size + 1) > m_entries.size())
+            grow(2 * (m_size + 1));
+        uint64 h = hash_str(sz, reinterpret_cast<unsigned char const *>(begin) + offset, 17);
+        size_t mask = m_entries.size() - 1;
+        size_t i = table_index(h, m_shift);
+        for (;; i = (i + 1) & mask) {
+            entry const & e = m_entries[i];
+            if (e.m_offset == 0)
+                break;
+            if (e.m_hash == h && e.m_size == sz && memcmp(begin + e.m_offset, begin + offset, sz) == 0)
+                return e.m_offset;
+        }
+        m_entries[i] = entry{offset, sz, h};
+        m_size++;
+        return 0;
+    }
+
+    /* Make room for `n` entries without rehashing. */
+    void grow(size_t n) {
+        if (2 * n <= m_entries.size())
+            return;
+        unsigned log_capacity = 64 - m_shift;
+        while ((static_cast<size_t>(1) << log_capacity) < 2 * n)
+            log_capacity++;
+        std::vector<entry> old(static_cast<size_t>(1) << log_capacity);
+        old.swap(m_entries);
+        m_shift = 64 - log_capacity;
+        size_t mask = m_entries.size() - 1;
+        for (entry const & e : old) {
+            if (e.m_offset == 0)
+                continue;
+            size_t i = table_index(e.m_hash, m_shift);
+            while (m_entries[i].m_offset != 0)
+                i = (i + 1) & mask;
+            m_entries[i] = e;
+        }
     }
 };
 
 object_compactor::object_compactor(void * base_addr):
-    m_max_sharing_table(new max_sharing_table(this)),
+    m_obj_table(new obj_table(LEAN_COMPACTOR_TABLE_INIT_LOG_SZ)),
+    m_max_sharing_table(new max_sharing_table(LEAN_COMPACTOR_TABLE_INIT_LOG_SZ)),
     m_base_addr(base_addr),
     m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
     m_end(m_begin),
-    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ) {
+    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ),
+    m_next_chunk(LEAN_COMPACTED_CHUNK_SIZE) {
+    // allocate for root address, see `operator()`
+    alloc(sizeof(object_offset), /* is_object */ false);
 }
 
 object_compactor::~object_compactor() {
@@ -75,7 +236,12 @@ object_compactor::~object_compactor() {
 */
 object_offset g_null_offset = reinterpret_cast<object_offset>(static_cast<size_t>(-1) - 1);
 
-void * object_compactor::alloc(size_t sz) {
+void * object_compactor::alloc(size_t sz, bool is_object) {
+    if (is_object && size() >= m_next_chunk) {
+        // Remark: `save_max_sharing` may drop this object again, but then the next object starts at the same offset
+        m_chunk_offsets.push_back(size());
+        m_next_chunk = size() + LEAN_COMPACTED_CHUNK_SIZE;
+    }
     size_t rem = sz % sizeof(void*);
     if (rem != 0)
         sz = sz + sizeof(void*) - rem;
@@ -95,37 +261,117 @@ void * object_compactor::alloc(size_t sz) {
     return r;
 }
 
-void object_compactor::save(object * o, object * new_o) {
+/* Placeholders for references to the root of the `idx`-th section in the compactor of a partition, see
+   `object_compactor::m_section_idx`. They are neither scalars, offsets into a partition, nor `g_null_offset`. */
+static inline object_offset section_ref(size_t idx) {
+    return reinterpret_cast<object_offset>((static_cast<size_t>(1) << 62) | (idx << 3));
+}
+
+static inline bool is_section_ref(object_offset o) {
+    return (reinterpret_cast<size_t>(o) >> 62) == 1;
+}
+
+static inline size_t section_ref_idx(object_offset o) {
+    return (reinterpret_cast<size_t>(o) & ~(static_cast<size_t>(1) << 62)) >> 3;
+}
+
+/* Placeholders for references to objects in external regions in the compactor of a partition, which
+   `stitch` resolves depending on whether the sequential compactor would have copied the object. */
+static inline object_offset external_ref(object * o) {
+    return reinterpret_cast<object_offset>((static_cast<size_t>(1) << 61) | reinterpret_cast<size_t>(o));
+}
+
+static inline bool is_external_ref(object_offset o) {
+    return (reinterpret_cast<size_t>(o) >> 61) == 1;
+}
+
+static inline object * external_ref_obj(object_offset o) {
+    return reinterpret_cast<object *>(reinterpret_cast<size_t>(o) & ~(static_cast<size_t>(1) << 61));
+}
+
+/* Placeholders for references to objects owned by a previous partition in the compactor of a partition, see
+   `object_compactor::m_owners`. `stitch` has already copied them when it reaches the placeholder. */
+static inline object_offset owned_ref(object * o) {
+    return reinterpret_cast<object_offset>((static_cast<size_t>(1) << 60) | reinterpret_cast<size_t>(o));
+}
+
+static inline bool is_owned_ref(object_offset o) {
+    return (reinterpret_cast<size_t>(o) >> 60) == 1;
+}
+
+static inline object * owned_ref_obj(object_offset o) {
+    return reinterpret_cast<object *>(reinterpret_cast<size_t>(o) & ~(static_cast<size_t>(1) << 60));
+}
+
+object_offset object_compactor::save(object * o, object * new_o, size_t new_o_sz) {
     lean_assert(m_begin <= new_o && new_o < m_end);
-    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr))));
+    size_t pos = reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin);
+    if (m_record)
+        m_log.push_back(log_entry{o, pos, new_o_sz});
+    object_offset r = reinterpret_cast<object_offset>(pos + reinterpret_cast<size_t>(m_base_addr));
+    m_obj_table->insert(o, r);
+    return r;
 }
 
-void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
-    max_sharing_key k(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin), new_o_sz);
-    auto it = m_max_sharing_table->m_table.find(k);
-    if (it != m_max_sharing_table->m_table.end()) {
+object_offset object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
+    size_t offset = reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin);
+    if (size_t prev = m_max_sharing_table->find_or_insert(static_cast<char*>(m_begin), offset, new_o_sz)) {
         m_end = new_o;
-        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
-    } else {
-        m_max_sharing_table->m_table.insert(k);
+        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + prev);
     }
-    save(o, new_o);
+    return save(o, new_o, new_o_sz);
 }
 
 object_offset object_compactor::to_offset(object * o) {
     if (lean_is_scalar(o)) {
         return o;
     } else {
-        auto it = m_obj_table.find(o);
-        if (it == m_obj_table.end()) {
+        object_offset const * it = m_obj_table->find(o);
+        if (!it) {
+            if (m_section_idx) {
+                auto it2 = m_section_idx->find(o);
+                if (it2 != m_section_idx->end() && it2->second < m_num_prev_sections)
+                    return section_ref(it2->second);
+            }
+            if (m_allow_external) {
+                object_offset r = to_external(o);
+                if (r != g_null_offset)
+                    return r;
+            }
+            if (m_owners && m_owners->claim(o, m_part_idx) < m_part_idx) {
+                object_offset r = owned_ref(o);
+                m_obj_table->insert(o, r);
+                return r;
+            }
             m_todo.push_back(o);
             return g_null_offset;
         } else {
-            return it->second;
+            return *it;
         }
     }
 }
 
+/* Return the index of the external region containing `o`, or `m_external_regions.size()` if there is none. */
+size_t object_compactor::find_external_region(object * o) const {
+    char const * p = reinterpret_cast<char const *>(o);
+    auto it = std::upper_bound(m_external_regions.begin(), m_external_regions.end(), p,
+                               [](char const * p, external_region const & r) { return p < r.m_begin; });
+    if (it == m_external_regions.begin() || p >= (it - 1)->m_begin + (it - 1)->m_size)
+        return m_external_regions.size();
+    return (it - 1) - m_external_regions.begin();
+}
+
+/* If `o` is in an external region, reference it by its address instead of copying it. */
+object_offset object_compactor::to_external(object * o) {
+    size_t idx = find_external_region(o);
+    if (idx == m_external_regions.size())
+        return g_null_offset;
+    m_used_external_regions[idx] = true;
+    object_offset r = m_record ? external_ref(o) : o;
+    m_obj_table->insert(o, r);
+    return r;
+}
+
 object * object_compactor::copy_object(object * o) {
     size_t sz  = lean_object_byte_size(o);
     void * mem = alloc(sz);
@@ -284,7 +530,7 @@ void object_compactor::insert_mpz(object * o) {
     memcpy(data, m._mp_d, data_sz);
     m._mp_d = reinterpret_cast<mp_limb_t *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
     m._mp_alloc = nlimbs;
-    save(o, (lean_object*)new_o);
+    save(o, (lean_object*)new_o, sz);
 #else
     size_t data_sz = sizeof(mpn_digit) * to_mpz(o)->m_value.m_size;
     size_t sz      = sizeof(mpz_object) + data_sz;
@@ -294,7 +540,7 @@ void object_compactor::insert_mpz(object * o) {
     void * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, to_mpz(o)->m_value.m_digits, data_sz);
     new_o->m_value.m_digits = reinterpret_cast<mpn_digit *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
-    save(o, (lean_object*)new_o);
+    save(o, (lean_object*)new_o, sz);
 #endif
 }
 
@@ -336,19 +582,24 @@ tag_counter_manager g_tag_counter_manager;
 
 #endif
 
-void object_compactor::operator()(object * o) {
+void object_compactor::compact(object * o, bool allow_external) {
     lean_assert(m_todo.empty());
-    // allocate for root address, see end of function
-    alloc(sizeof(object_offset));
+    m_allow_external = allow_external && !m_external_regions.empty();
     if (!lean_is_scalar(o)) {
         m_todo.push_back(o);
         while (!m_todo.empty()) {
             object * curr = m_todo.back();
-            if (m_obj_table.find(curr) != m_obj_table.end()) {
+            if (m_obj_table->find(curr)) {
                 m_todo.pop_back();
                 continue;
             }
             lean_assert(!lean_is_scalar(curr));
+            if (m_owners && (lean_ptr_tag(curr) == LeanThunk || lean_ptr_tag(curr) == LeanTask))
+                m_owners->m_abort.store(true, std::memory_order_relaxed);
+            if (m_owners && m_owners->m_abort.load(std::memory_order_relaxed)) {
+                m_todo.clear();
+                break;
+            }
             bool r = true;
 #ifdef LEAN_TAG_COUNTERS
             g_tag_counters[lean_ptr_tag(curr)]++;
@@ -371,22 +622,192 @@ void object_compactor::operator()(object * o) {
         }
         m_tmp.clear();
     }
+}
+
+void object_compactor::add_section(object * o, bool allow_external) {
+    m_sections.push_back(o);
+    m_section_allow_external.push_back(allow_external);
+}
+
+void object_compactor::set_external_regions(std::vector<external_region> regions) {
+    std::sort(regions.begin(), regions.end(),
+              [](external_region const & a, external_region const & b) { return a.m_begin < b.m_begin; });
+    m_external_regions = std::move(regions);
+    m_used_external_regions.assign(m_external_regions.size(), false);
+}
+
+std::vector<external_region> object_compactor::used_external_regions() const {
+    std::vector<external_region> r;
+    for (size_t i = 0; i < m_external_regions.size(); i++) {
+        if (m_used_external_regions[i])
+            r.push_back(m_external_regions[i]);
+    }
+    return r;
+}
+
+/* Append the objects compacted by the compactor of a partition, see `compact_parallel`, to this compactor.
+   `part` has recorded the objects in the order in which the sequential compactor would have visited them
+   if we skip the objects already compacted by previous partitions, so replaying the log results in exactly
+   the same output, including maximal sharing and chunk offsets. */
+void object_compactor::stitch(object_compactor const & part) {
+    std::vector<object_offset> local2final(part.size() / sizeof(void*), g_null_offset);
+    auto resolve = [&](object_offset c) {
+        if (lean_is_scalar(c))
+            return c;
+        if (is_section_ref(c))
+            return *m_obj_table->find(m_sections[section_ref_idx(c)]);
+        if (is_external_ref(c)) {
+            object * o = external_ref_obj(c);
+            if (object_offset const * it = m_obj_table->find(o))
+                return *it;
+            m_used_external_regions[find_external_region(o)] = true;
+            m_obj_table->insert(o, o);
+            return o;
+        }
+        if (is_owned_ref(c))
+            return *m_obj_table->find(owned_ref_obj(c));
+        return local2final[reinterpret_cast<size_t>(c) / sizeof(void*)];
+    };
+    m_obj_table->grow(m_obj_table->m_size + part.m_log.size());
+    m_max_sharing_table->grow(m_max_sharing_table->m_size + part.m_log.size());
+    for (log_entry const & e : part.m_log) {
+        object_offset r;
+        if (object_offset const * it = m_obj_table->find(e.m_obj)) {
+            r = *it;
+        } else {
+            object * new_o = static_cast<object*>(alloc(e.m_size));
+            memcpy(new_o, static_cast<char const *>(part.m_begin) + e.m_offset, e.m_size);
+            uint8 tag = lean_ptr_tag(new_o);
+            if (tag <= LeanMaxCtorTag) {
+                for (unsigned i = 0; i < lean_ctor_num_objs(new_o); i++)
+                    lean_ctor_set(new_o, i, resolve(lean_ctor_get(new_o, i)));
+            } else if (tag == LeanArray) {
+                for (size_t i = 0; i < lean_array_size(new_o); i++)
+                    lean_array_set_core(new_o, i, resolve(lean_array_get_core(new_o, i)));
+            } else if (tag == LeanThunk) {
+                lean_to_thunk(new_o)->m_value = resolve(lean_to_thunk(new_o)->m_value);
+            } else if (tag == LeanRef) {
+                lean_to_ref(new_o)->m_value = resolve(lean_to_ref(new_o)->m_value);
+            } else if (tag == LeanTask) {
+                lean_to_task(new_o)->m_value = resolve(lean_to_task(new_o)->m_value);
+            } else if (tag == LeanPromise) {
+                lean_to_promise(new_o)->m_result = (lean_task_object *)resolve((object *)lean_to_promise(new_o)->m_result);
+            }
+            if (tag == LeanMPZ) {
+                char * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
+                ptrdiff_t off = data - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr);
+#ifdef LEAN_USE_GMP
+                to_mpz(new_o)->m_value.m_val[0]._mp_d = reinterpret_cast<mp_limb_t *>(off);
+#else
+                to_mpz(new_o)->m_value.m_digits = reinterpret_cast<mpn_digit *>(off);
+#endif
+                r = save(e.m_obj, new_o, e.m_size);
+            } else {
+                r = save_max_sharing(e.m_obj, new_o, e.m_size);
+            }
+        }
+        object_offset & l = local2final[e.m_offset / sizeof(void*)];
+        if (l == g_null_offset)
+            l = r;
+    }
+}
+
+struct object_compactor::partition {
+    object_compactor m_compactor;
+    std::vector<object *> m_roots;
+    std::vector<bool> m_allow_external;
+};
+
+object * object_compactor::compact_partition_fn(object * p, object *) {
+    partition * part = reinterpret_cast<partition *>(lean_unbox_usize(p));
+    for (size_t i = 0; i < part->m_roots.size() && !part->m_compactor.m_owners->m_abort.load(std::memory_order_relaxed); i++)
+        part->m_compactor.compact(part->m_roots[i], part->m_allow_external[i]);
+    lean_dec(p);
+    return lean_box(0);
+}
+
+/* Compact the sections and `root` by splitting them into partitions of consecutive sections (and a final
+   partition containing just `root`) that are compacted concurrently by separate compactors, and then
+   stitched together in order. There are at most as many partitions as task manager workers. Each
+   partition stops at references to the roots of previous sections and at objects already reached by a
+   previous partition according to the shared `owner_table`, which are thus compacted by the latter. Other
+   objects may still be traversed by several partitions if a later one reaches them first, and `stitch`
+   then skips all but the first copy. The graph is only read, which is safe without marking it multi-threaded
+   except for thunks and tasks, which the compactor forces. If a partition reaches one, all partitions stop,
+   and we return `false` without having modified this compactor. */
+bool object_compactor::compact_parallel(object * root, size_t num_parts) {
+    std::unordered_map<object*, size_t> section_idx;
+    for (size_t i = 0; i < m_sections.size(); i++) {
+        if (!lean_is_scalar(m_sections[i]))
+            section_idx.emplace(m_sections[i], i);
+    }
+    owner_table owners;
+    std::vector<partition *> parts;
+    std::vector<object *> tasks;
+    for (size_t i = 0; i <= num_parts; i++) {
+        partition * part = new partition();
+        part->m_compactor.m_record      = true;
+        part->m_compactor.m_section_idx = &section_idx;
+        part->m_compactor.m_owners      = &owners;
+        part->m_compactor.m_part_idx    = i;
+        part->m_compactor.m_external_regions = m_external_regions;
+        part->m_compactor.m_used_external_regions.assign(m_external_regions.size(), false);
+        if (i < num_parts) {
+            size_t begin = m_sections.size() * i / num_parts;
+            size_t end   = m_sections.size() * (i + 1) / num_parts;
+            part->m_compactor.m_num_prev_sections = begin;
+            part->m_roots.assign(m_sections.begin() + begin, m_sections.begin() + end);
+            part->m_allow_external.assign(m_section_allow_external.begin() + begin, m_section_allow_external.begin() + end);
+        } else {
+            part->m_compactor.m_num_prev_sections = m_sections.size();
+            part->m_roots.push_back(root);
+            part->m_allow_external.push_back(true);
+        }
+        parts.push_back(part);
+        object * c = lean_alloc_closure((void*)compact_partition_fn, 2, 1);
+        lean_closure_set(c, 0, lean_box_usize(reinterpret_cast<size_t>(part)));
+        tasks.push_back(lean_task_spawn(c, lean_box(0)));
+    }
+    for (object * t : tasks)
+        lean_dec(lean_task_get_own(t));
+    bool aborted = owners.m_abort.load();
+    for (partition * part : parts) {
+        if (!aborted)
+            stitch(part->m_compactor);
+        delete part;
+    }
+    return !aborted;
+}
+
+void object_compactor::operator()(object * o) {
+    // one of the workers compacts `root`
+    size_t num_workers = get_task_manager_num_workers();
+    size_t num_parts   = std::min(m_sections.size() / LEAN_COMPACTOR_MIN_PARTITION_SECTIONS, num_workers > 0 ? num_workers - 1 : 0);
+    if (num_parts < 2 || !compact_parallel(o, num_parts)) {
+        for (size_t i = 0; i < m_sections.size(); i++)
+            compact(m_sections[i], m_section_allow_external[i]);
+        compact(o, true);
+    }
     *static_cast<object_offset *>(m_begin) = to_offset(o);
 }
 
-compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data):
+compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data,
+                                   std::vector<size_t> chunk_offsets):
     m_base_addr(base_addr),
     m_is_mmap(is_mmap),
     m_free_data(free_data),
     m_begin(data),
     m_next(data),
-    m_end(static_cast<char*>(data)+sz) {
+    m_end(static_cast<char*>(data)+sz),
+    m_size(sz),
+    m_chunk_offsets(std::move(chunk_offsets)) {
 }
 
 compacted_region::compacted_region(object_compactor const & c):
     m_begin(malloc(c.size())),
     m_next(m_begin),
-    m_end(static_cast<char*>(m_begin) + c.size()) {
+    m_end(static_cast<char*>(m_begin) + c.size()),
+    m_size(c.size()) {
     memcpy(m_begin, c.data(), c.size());
 }
 
@@ -394,24 +815,79 @@ compacted_region::~compacted_region() {
     m_free_data();
 }
 
-inline object * compacted_region::fix_object_ptr(object * o) {
-    if (lean_is_scalar(o)) return o;
-    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + (reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_base_addr)));
-}
-
-inline void compacted_region::move(size_t d) {
-    lean_assert(m_next < m_end);
+static inline size_t align_obj_size(size_t d) {
     size_t rem = d % sizeof(void*);
     if (rem != 0)
         d = d + sizeof(void*) - rem;
-    m_next = static_cast<char*>(m_next) + d;
+    return d;
+}
+
+void compacted_region::set_external_regions(std::vector<external_region> regions) {
+    std::sort(regions.begin(), regions.end(), [](external_region const & r1, external_region const & r2) {
+        return r1.m_begin < r2.m_begin;
+    });
+    m_external_regions = std::move(regions);
+    m_external_offsets.clear();
+    size_t off = 0;
+    for (external_region const & r : m_external_regions) {
+        m_external_offsets.push_back(off);
+        off += r.m_size;
+    }
+}
+
+/* Return the index of the external region containing `o`, or `m_external_regions.size()` if there is none. */
+size_t compacted_region::find_external_region(object * o) const {
+    char const * p = reinterpret_cast<char const *>(o);
+    auto it = std::upper_bound(m_external_regions.begin(), m_external_regions.end(), p, [](char const * p, external_region const & r) {
+        return p < r.m_begin;
+    });
+    if (it == m_external_regions.begin() || static_cast<size_t>(p - (it - 1)->m_begin) >= (it - 1)->m_size)
+        return m_external_regions.size();
+    return it - 1 - m_external_regions.begin();
+}
+
+/* References into external regions, see `set_external_regions`, are not resolved when relocating the region.
+   As the region may now overlap the original addresses of the external regions, they are instead stored as
+   offsets past the end of the region, the external regions being laid out there one after another, until
+   `relocate_external_refs` resolves them. */
+inline object * compacted_region::fix_object_ptr(object * o) const {
+    if (lean_is_scalar(o)) return o;
+    if (LEAN_UNLIKELY(m_external_deltas != nullptr))
+        return fix_external_ptr(o);
+    size_t off = reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_base_addr);
+    if (LEAN_LIKELY(off < m_size))
+        return reinterpret_cast<object*>(static_cast<char*>(m_begin) + off);
+    size_t idx = find_external_region(o);
+    lean_always_assert(idx < m_external_regions.size());
+    off = m_size + m_external_offsets[idx] + (reinterpret_cast<char const *>(o) - m_external_regions[idx].m_begin);
+    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + off);
 }
 
-inline void compacted_region::move(object * o) {
-    return move(lean_object_byte_size(o));
+/* Resolve `o` during `relocate_external_refs`. */
+object * compacted_region::fix_external_ptr(object * o) const {
+    size_t off = reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_begin);
+    if (off < m_size) return o;
+    size_t idx;
+    if (m_begin == m_base_addr) {
+        // not relocated by `read`, so `o` still points into the original external region
+        idx = find_external_region(o);
+        lean_always_assert(idx < m_external_regions.size());
+        off = reinterpret_cast<char const *>(o) - m_external_regions[idx].m_begin;
+    } else {
+        off -= m_size;
+        idx = std::upper_bound(m_external_offsets.begin(), m_external_offsets.end(), off) - m_external_offsets.begin() - 1;
+        lean_always_assert(idx < m_external_regions.size() && off - m_external_offsets[idx] < m_external_regions[idx].m_size);
+        off -= m_external_offsets[idx];
+    }
+    return reinterpret_cast<object*>(reinterpret_cast<size_t>(m_external_regions[idx].m_begin) + off + (*m_external_deltas)[idx]);
 }
 
-inline void compacted_region::fix_constructor(object * o) {
+inline void compacted_region::move(size_t d) {
+    lean_assert(m_next < m_end);
+    m_next = static_cast<char*>(m_next) + align_obj_size(d);
+}
+
+inline size_t compacted_region::fix_constructor(object * o) const {
     lean_assert(!lean_has_rc(o));
     object ** it  = lean_ctor_obj_cptr(o);
     object ** end = it + lean_ctor_num_objs(o);
@@ -419,49 +895,89 @@ inline void compacted_region::fix_constructor(object * o) {
         *it = fix_object_ptr(*it);
     }
     lean_assert(lean_object_byte_size(o) < 4192);
-    move(o);
+    return lean_object_byte_size(o);
 }
 
-inline void compacted_region::fix_array(object * o) {
+inline size_t compacted_region::fix_array(object * o) const {
     object ** it  = lean_array_cptr(o);
     object ** end = it + lean_array_size(o);
     for (; it != end; it++) {
         *it = fix_object_ptr(*it);
     }
-    move(o);
+    return lean_object_byte_size(o);
 }
 
-inline void compacted_region::fix_thunk(object * o) {
+inline size_t compacted_region::fix_thunk(object * o) const {
     lean_to_thunk(o)->m_value = fix_object_ptr(lean_to_thunk(o)->m_value);
-    move(sizeof(lean_thunk_object));
+    return sizeof(lean_thunk_object);
 }
 
-inline void compacted_region::fix_ref(object * o) {
+inline size_t compacted_region::fix_ref(object * o) const {
     lean_to_ref(o)->m_value = fix_object_ptr(lean_to_ref(o)->m_value);
-    move(sizeof(lean_ref_object));
+    return sizeof(lean_ref_object);
 }
 
-inline void compacted_region::fix_task(object * o) {
+inline size_t compacted_region::fix_task(object * o) const {
     lean_to_task(o)->m_value = fix_object_ptr(lean_to_task(o)->m_value);
-    move(sizeof(lean_task_object));
+    return sizeof(lean_task_object);
 }
 
-inline void compacted_region::fix_promise(object * o) {
+inline size_t compacted_region::fix_promise(object * o) const {
     lean_to_promise(o)->m_result = (lean_task_object *)fix_object_ptr((lean_object *)lean_to_promise(o)->m_result);
-    move(sizeof(lean_promise_object));
+    return sizeof(lean_promise_object);
 }
 
-void compacted_region::fix_mpz(object * o) {
+size_t compacted_region::fix_mpz(object * o) const {
 #ifdef LEAN_USE_GMP
     __mpz_struct & m = to_mpz(o)->m_value.m_val[0];
-    m._mp_d = reinterpret_cast<mp_limb_t *>(static_cast<char *>(m_begin) + reinterpret_cast<size_t>(m._mp_d) - reinterpret_cast<size_t>(m_base_addr));
-    move(sizeof(mpz_object) + sizeof(mp_limb_t) * mpz_size(to_mpz(o)->m_value.m_val));
+    if (m_external_deltas == nullptr)
+        m._mp_d = reinterpret_cast<mp_limb_t *>(static_cast<char *>(m_begin) + reinterpret_cast<size_t>(m._mp_d) - reinterpret_cast<size_t>(m_base_addr));
+    return sizeof(mpz_object) + sizeof(mp_limb_t) * mpz_size(to_mpz(o)->m_value.m_val);
 #else
     to_mpz(o)->m_value.m_digits = reinterpret_cast<mpn_digit*>(reinterpret_cast<char*>(o) + sizeof(mpz_object));
-    move(sizeof(mpz_object) + sizeof(mpn_digit) * to_mpz(o)->m_value.m_size);
+    return sizeof(mpz_object) + sizeof(mpn_digit) * to_mpz(o)->m_value.m_size;
 #endif
 }
 
+/* Fix the pointers of the object `o`, and return its size in the region. */
+inline size_t compacted_region::fix_object(object * o) const {
+    uint8 tag = lean_ptr_tag(o);
+    if (tag <= LeanMaxCtorTag)
+        return align_obj_size(fix_constructor(o));
+    switch (tag) {
+    case LeanClosure:         lean_unreachable();
+    case LeanArray:           return align_obj_size(fix_array(o));
+    case LeanScalarArray:     return align_obj_size(lean_sarray_byte_size(o));
+    case LeanString:          return align_obj_size(lean_string_byte_size(o));
+    case LeanMPZ:             return align_obj_size(fix_mpz(o));
+    case LeanThunk:           return align_obj_size(fix_thunk(o));
+    case LeanRef:             return align_obj_size(fix_ref(o));
+    case LeanTask:            return align_obj_size(fix_task(o));
+    case LeanPromise:         return align_obj_size(fix_promise(o));
+    case LeanExternal:        lean_unreachable();
+    default:                  lean_unreachable();
+    }
+}
+
+/* Fix the pointers of all objects in `[begin, end)`, which must start at an object boundary. */
+void compacted_region::fix_objects(char * begin, char * end) const {
+    while (begin < end)
+        begin += fix_object(reinterpret_cast<object*>(begin));
+}
+
+/* Fix the `idx`-th chunk, i.e., the objects from `m_chunk_offsets[idx]` to the next chunk offset. */
+void compacted_region::fix_chunk(size_t idx) const {
+    char * begin = static_cast<char*>(m_begin) + m_chunk_offsets[idx];
+    char * end   = idx + 1 < m_chunk_offsets.size() ? static_cast<char*>(m_begin) + m_chunk_offsets[idx + 1] : static_cast<char*>(m_end);
+    fix_objects(begin, end);
+}
+
+object * compacted_region::fix_chunk_fn(object * region, object * idx, object *) {
+    reinterpret_cast<compacted_region *>(lean_unbox_usize(region))->fix_chunk(lean_unbox(idx));
+    lean_dec(region);
+    return lean_box(0);
+}
+
 object * compacted_region::read() {
     if (m_next == m_end)
         return nullptr; /* all objects have been read */
@@ -475,30 +991,37 @@ object * compacted_region::read() {
     }
     lean_assert(!m_is_mmap);
 
-    while (m_next < m_end) {
-        object * curr = reinterpret_cast<object*>(m_next);
-        uint8 tag = lean_ptr_tag(curr);
-        if (tag <= LeanMaxCtorTag) {
-            fix_constructor(curr);
-        } else {
-            switch (tag) {
-            case LeanClosure:         lean_unreachable();
-            case LeanArray:           fix_array(curr); break;
-            case LeanScalarArray:     move(lean_sarray_byte_size(curr)); break;
-            case LeanString:          move(lean_string_byte_size(curr)); break;
-            case LeanMPZ:             fix_mpz(curr); break;
-            case LeanThunk:           fix_thunk(curr); break;
-            case LeanRef:             fix_ref(curr); break;
-            case LeanTask:            fix_task(curr); break;
-            case LeanPromise:         fix_promise(curr); break;
-            case LeanExternal:        lean_unreachable();
-            default:                  lean_unreachable();
-            }
+    char * next = static_cast<char*>(m_next);
+    if (m_chunk_offsets.empty() || hardware_concurrency() < 2) {
+        fix_objects(next, static_cast<char*>(m_end));
+    } else {
+        /* Chunks contain disjoint sets of objects, and fixing an object only accesses the object itself,
+           so we can fix chunks in parallel. The first objects until the first chunk offset are fixed on
+           the current thread. */
+        std::vector<object *> tasks;
+        for (size_t i = 0; i < m_chunk_offsets.size(); i++) {
+            object * c = lean_alloc_closure((void*)fix_chunk_fn, 3, 2);
+            lean_closure_set(c, 0, lean_box_usize(reinterpret_cast<size_t>(this)));
+            lean_closure_set(c, 1, lean_box(i));
+            tasks.push_back(lean_task_spawn(c, lean_box(0)));
         }
+        fix_objects(next, static_cast<char*>(m_begin) + m_chunk_offsets[0]);
+        for (object * t : tasks)
+            lean_dec(lean_task_get_own(t));
     }
+    m_next = m_end;
     return root;
 }
 
+void compacted_region::relocate_external_refs(std::vector<size_t> const & deltas) {
+    lean_assert(!m_external_refs_relocated && deltas.size() == m_external_regions.size());
+    m_external_deltas = &deltas;
+    char * begin = static_cast<char*>(m_begin) + align_obj_size(sizeof(object_offset));
+    fix_objects(begin, static_cast<char*>(m_begin) + m_size);
+    m_external_deltas = nullptr;
+    m_external_refs_relocated = true;
+}
+
 extern "C" LEAN_EXPORT uint8 lean_compacted_region_is_memory_mapped(usize region) {
     return reinterpret_cast<compacted_region *>(region)->is_memory_mapped();
 }
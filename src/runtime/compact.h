@@ -13,14 +13,48 @@ Author: Leonardo de Moura
 namespace lean {
 typedef lean_object * object_offset;
 
+/* A memory range containing persistent objects that a compacted region may reference by address instead
+   of copying them, e.g. a `mmap`ped .olean file. See `object_compactor::set_external_regions`. */
+struct external_region {
+    char const * m_begin;
+    size_t       m_size;
+    // identifies the contents of the range
+    uint64       m_hash;
+};
+
 class LEAN_EXPORT object_compactor {
+    struct obj_table;
     struct max_sharing_table;
-    friend struct max_sharing_hash;
-    friend struct max_sharing_eq;
-    std::unordered_map<object*, object_offset, std::hash<object*>, std::equal_to<object*>> m_obj_table;
+    std::unique_ptr<obj_table> m_obj_table;
     std::unique_ptr<max_sharing_table> m_max_sharing_table;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
+    // see `add_section`
+    std::vector<object*> m_sections;
+    std::vector<bool> m_section_allow_external;
+    // see `set_external_regions`; sorted by address
+    std::vector<external_region> m_external_regions;
+    std::vector<bool> m_used_external_regions;
+    bool m_allow_external = false;
+    /* Used by the compactors of partitions in `compact_parallel`: references to the roots of the first
+       `m_num_prev_sections` sections, which are compacted by previous partitions, become placeholders
+       (see `section_ref`) instead of being traversed. */
+    std::unordered_map<object*, size_t> const * m_section_idx = nullptr;
+    size_t m_num_prev_sections = 0;
+    /* Also used by the compactors of partitions: objects that a partition with an index smaller than
+       `m_part_idx` has reached become placeholders (see `owned_ref`) instead of being traversed. */
+    struct owner_table;
+    owner_table * m_owners = nullptr;
+    size_t m_part_idx = 0;
+    /* If `m_record` is set, `save` logs every object in order, which `stitch` replays. */
+    struct log_entry {
+        object * m_obj;
+        size_t   m_offset;
+        size_t   m_size;
+    };
+    bool m_record = false;
+    std::vector<log_entry> m_log;
+    struct partition;
     // On-disk base address used for `mmap`ing compacted regions without relocations
     // References within the compacted region are rewritten by subtracting `m_begin` and adding `m_base_addr`
     // In the simplest case `base_addr == nullptr`, we get region-relative pointers
@@ -28,10 +62,13 @@ class LEAN_EXPORT object_compactor {
     void * m_begin;
     void * m_end;
     void * m_capacity;
+    // Offsets of the first object allocated after every `LEAN_COMPACTED_CHUNK_SIZE` bytes, see `compacted_region::read`
+    std::vector<size_t> m_chunk_offsets;
+    size_t m_next_chunk;
     size_t capacity() const { return static_cast<char*>(m_capacity) - static_cast<char*>(m_begin); }
-    void save(object * o, object * new_o);
-    void save_max_sharing(object * o, object * new_o, size_t new_o_sz);
-    void * alloc(size_t sz);
+    object_offset save(object * o, object * new_o, size_t new_o_sz);
+    object_offset save_max_sharing(object * o, object * new_o, size_t new_o_sz);
+    void * alloc(size_t sz, bool is_object = true);
     object_offset to_offset(object * o);
     void insert_terminator(object * o);
     object * copy_object(object * o);
@@ -44,6 +81,12 @@ class LEAN_EXPORT object_compactor {
     bool insert_promise(object * o);
     bool insert_ref(object * o);
     void insert_mpz(object * o);
+    void compact(object * o, bool allow_external);
+    size_t find_external_region(object * o) const;
+    object_offset to_external(object * o);
+    void stitch(object_compactor const & part);
+    bool compact_parallel(object * root, size_t num_parts);
+    static object * compact_partition_fn(object * part, object * unit);
 public:
     object_compactor(void * base_addr = nullptr);
     object_compactor(object_compactor const &) = delete;
@@ -51,9 +94,26 @@ public:
     ~object_compactor();
     object_compactor operator=(object_compactor const &) = delete;
     object_compactor operator=(object_compactor &&) = delete;
+    /* Add `o` as the root of a section: `operator()` compacts the object graphs reachable from the sections
+       in order, each into a contiguous part of `data()` skipping objects of previous sections, before the
+       rest of the graph reachable from its root. Sections are the unit of parallelism of `operator()`, see
+       `compact_parallel`; the result does not depend on it. */
+    void add_section(object * o, bool allow_external = true);
+    /* Objects inside the given ranges are not copied but referenced by their address, unless they are first
+       reached from a section added with `allow_external = false`. The ranges must not overlap each other,
+       and the region read from the result may only be used while they are still mapped at the same
+       addresses. Must be called before `operator()`. */
+    void set_external_regions(std::vector<external_region> regions);
+    /* Compact the object graph reachable from the root `o`. Must be called exactly once, after all
+       `add_section` calls. */
     void operator()(object * o);
+    /* The external regions, see `set_external_regions`, that are actually referenced by `data()`. */
+    std::vector<external_region> used_external_regions() const;
     size_t size() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
     void const * data() const { return m_begin; }
+    /* Offsets into `data()` at which objects start, and that split the data into chunks of roughly
+       `LEAN_COMPACTED_CHUNK_SIZE` bytes. They allow `compacted_region::read` to relocate chunks in parallel. */
+    std::vector<size_t> const & chunk_offsets() const { return m_chunk_offsets; }
 };
 
 class LEAN_EXPORT compacted_region {
@@ -64,20 +124,36 @@ class LEAN_EXPORT compacted_region {
     void * m_begin;
     void * m_next;
     void * m_end;
+    size_t m_size;
+    // see `object_compactor::chunk_offsets`
+    std::vector<size_t> m_chunk_offsets;
+    // see `object_compactor::used_external_regions`, sorted by address
+    std::vector<external_region> m_external_regions;
+    // `m_external_offsets[i]` is the sum of the sizes of the first `i` external regions
+    std::vector<size_t> m_external_offsets;
+    // set during `relocate_external_refs`
+    std::vector<size_t> const * m_external_deltas = nullptr;
+    bool m_external_refs_relocated = false;
     void move(size_t d);
-    void move(object * o);
-    object * fix_object_ptr(object * o);
-    void fix_constructor(object * o);
-    void fix_array(object * o);
-    void fix_thunk(object * o);
-    void fix_ref(object * o);
-    void fix_task(object * o);
-    void fix_promise(object * o);
-    void fix_mpz(object * o);
+    size_t find_external_region(object * o) const;
+    object * fix_object_ptr(object * o) const;
+    object * fix_external_ptr(object * o) const;
+    size_t fix_constructor(object * o) const;
+    size_t fix_array(object * o) const;
+    size_t fix_thunk(object * o) const;
+    size_t fix_ref(object * o) const;
+    size_t fix_task(object * o) const;
+    size_t fix_promise(object * o) const;
+    size_t fix_mpz(object * o) const;
+    size_t fix_object(object * o) const;
+    void fix_objects(char * begin, char * end) const;
+    static object * fix_chunk_fn(object * region, object * idx, object * unit);
+    void fix_chunk(size_t idx) const;
 public:
     /* Creates a compacted object region using the given region in memory.
        This object takes ownership of the region. */
-    compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data);
+    compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data,
+                     std::vector<size_t> chunk_offsets = std::vector<size_t>());
     /* Creates a compacted object region using the object_compactor current state.
        It creates a copy of the compacted region generated by the object compactor. */
     explicit compacted_region(object_compactor const & c);
@@ -88,5 +164,17 @@ public:
     compacted_region operator=(compacted_region &&) = delete;
     object * read();
     bool is_memory_mapped() const { return m_is_mmap; }
+    /* Pointers outside of the region itself must point into these ranges, see
+       `object_compactor::set_external_regions`. They are not resolved by `read`, so objects that may
+       reference external ones may only be accessed after `relocate_external_refs` or, if the region was
+       not relocated and all ranges are still mapped at their addresses, right away. Must be called before `read`. */
+    void set_external_regions(std::vector<external_region> regions);
+    std::vector<external_region> const & external_regions() const { return m_external_regions; }
+    void * data() const { return m_begin; }
+    size_t size() const { return m_size; }
+    /* Resolve the pointers into the external regions, given that the contents of the `i`-th of them are now
+       at its address plus `deltas[i]`. The region must be writable. */
+    void relocate_external_refs(std::vector<size_t> const & deltas);
+    bool external_refs_relocated() const { return m_external_refs_relocated; }
 };
 }
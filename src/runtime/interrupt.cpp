@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include "runtime/interrupt.h"
 #include "runtime/exception.h"
 #include "runtime/memory.h"
+#include "runtime/object.h"
 #include "lean/lean.h"
 #include "util/io.h"
 
@@ -58,6 +59,7 @@ void check_interrupted() {
 }
 
 void check_system(char const * component_name, bool do_check_interrupted) {
+    process_biased_rc_queue();
     check_stack(component_name);
     check_memory(component_name);
     if (do_check_interrupted) {
@@ -72,6 +74,7 @@ void sleep_for(unsigned ms, unsigned step_ms) {
     unsigned rounds = ms / step_ms;
     chrono::milliseconds c(step_ms);
     chrono::milliseconds r(ms % step_ms);
+    process_biased_rc_queue();
     for (unsigned i = 0; i < rounds; i++) {
         this_thread::sleep_for(c);
         check_interrupted();
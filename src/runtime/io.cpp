@@ -920,6 +920,30 @@ extern "C" LEAN_EXPORT obj_res lean_io_set_heartbeats(obj_arg count, obj_arg /*
     return io_result_mk_ok(box(0));
 }
 
+/* getAllocatorStats : BaseIO AllocatorStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_allocator_stats(obj_arg /* w */) {
+    alloc_stats s = get_alloc_stats();
+    object * live = lean_alloc_array(0, s.m_live_objs.size());
+    for (auto const & p : s.m_live_objs) {
+        object * e = lean_alloc_ctor(0, 2, 0);
+        lean_ctor_set(e, 0, lean_usize_to_nat(p.first));
+        lean_ctor_set(e, 1, lean_uint64_to_nat(p.second));
+        live = lean_array_push(live, e);
+    }
+    object * r = lean_alloc_ctor(0, 10, 0);
+    lean_ctor_set(r, 0, lean_uint64_to_nat(s.m_num_heaps));
+    lean_ctor_set(r, 1, lean_uint64_to_nat(s.m_num_segments));
+    lean_ctor_set(r, 2, lean_uint64_to_nat(s.m_num_huge_page_segments));
+    lean_ctor_set(r, 3, lean_uint64_to_nat(s.m_num_pages));
+    lean_ctor_set(r, 4, lean_uint64_to_nat(s.m_num_empty_pages));
+    lean_ctor_set(r, 5, lean_uint64_to_nat(s.m_num_decommitted_pages));
+    lean_ctor_set(r, 6, lean_uint64_to_nat(s.m_num_remote_frees));
+    lean_ctor_set(r, 7, lean_uint64_to_nat(s.m_num_large_allocs));
+    lean_ctor_set(r, 8, lean_uint64_to_nat(s.m_large_bytes));
+    lean_ctor_set(r, 9, live);
+    return io_result_mk_ok(r);
+}
+
 extern "C" LEAN_EXPORT obj_res lean_io_getenv(b_obj_arg env_var, obj_arg) {
 #if defined(LEAN_EMSCRIPTEN)
     // HACK(WN): getenv doesn't seem to work in Emscripten even though it should
@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include "runtime/exception.h"
 #include "runtime/memory.h"
 #include "runtime/thread.h"
+#include "runtime/alloc.h"
 
 #ifndef LEAN_CHECK_MEM_THRESHOLD
 #define LEAN_CHECK_MEM_THRESHOLD 200
@@ -113,6 +114,8 @@ size_t get_current_rss() {
 namespace lean {
 static size_t g_max_memory = 0;
 LEAN_THREAD_VALUE(size_t, g_counter, 0);
+/* Number of upcoming checks that skip reading the current RSS, see `check_memory` */
+LEAN_THREAD_VALUE(size_t, g_rss_skip, 0);
 
 void set_max_memory(size_t max) {
     g_max_memory = max;
@@ -134,12 +137,32 @@ void check_memory(char const * component_name) {
     g_counter++;
     if (g_counter >= LEAN_CHECK_MEM_THRESHOLD) {
         g_counter = 0;
+        // Above 90% of the limit, we make the allocator return unused memory to the OS eagerly,
+        // until we are back under 80% of it.
+        size_t high = g_max_memory / 10 * 9;
+        size_t low  = g_max_memory / 10 * 8;
         // We try first get_peak_rss because it is much faster
         // than get_current_rss on Linux.
         size_t r = get_peak_rss();
-        if (r > 0 && r < g_max_memory) return;
+        if (r > 0 && r < low) return;
+        // The peak does not go down again, so we read the current RSS, which is slower, but skip one
+        // check for every percent of the limit that we stayed below `low` the last time.
+        if (g_rss_skip > 0) {
+            g_rss_skip--;
+            return;
+        }
         r = get_current_rss();
-        if (r == 0 || r < g_max_memory) return;
+        if (r == 0) return;
+        if (r < low) {
+            reset_memory_pressure();
+            g_rss_skip = (low - r) / (g_max_memory / 100 + 1);
+            return;
+        }
+        if (r < high) return;
+        release_free_memory();
+        if (r < g_max_memory) return;
+        r = get_current_rss();
+        if (r < g_max_memory) return;
         throw_memory_exception(component_name);
     }
 }
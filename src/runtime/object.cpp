@@ -5,9 +5,11 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <unordered_map>
 #include <cmath>
 #include <lean/lean.h>
 #include "runtime/object.h"
@@ -28,6 +30,10 @@ Author: Leonardo de Moura
     #define LEAN_SUPPORTS_BACKTRACE 0
 #endif
 
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
 #if LEAN_SUPPORTS_BACKTRACE
 #include <execinfo.h>
 #include <unistd.h>
@@ -57,6 +63,17 @@ extern "C" LEAN_EXPORT __attribute__((weak)) void free_sized(void *ptr, size_t)
 #define LEAN_MAX_PRIO 8
 #define LEAN_SYNC_PRIO std::numeric_limits<unsigned>::max()
 
+namespace lean { struct task_waiter; }
+
+/* Registration of a thread blocked in `Task.get` or `IO.waitAny` on an unfinished task, linked into
+   `lean_task_imp::m_waiters`. Protected by the task manager mutex. */
+struct lean_task_waiter {
+    lean::task_waiter *  m_waiter;
+    lean_task_waiter *   m_next;
+    // `nullptr` after the task has finished and the registration has been removed from its list
+    lean_task_waiter **  m_prev;
+};
+
 namespace lean {
 
 static bool should_abort_on_panic() {
@@ -159,11 +176,213 @@ extern "C" LEAN_EXPORT object * lean_sorry(uint8) {
     lean_unreachable();
 }
 
+#ifdef LEAN_BIASED_RC
+/* Biased reference counting for multi threaded objects.
+
+   `lean_mark_mt` makes the current thread the owner of the objects it marks. The owner keeps updating `m_rc`
+   non-atomically: an owned object with `m_rc == -(n+1)` has `n` references held through the owner.
+   Other threads update the atomic word `m_shared_rc`, which stores a (possibly negative) reference counter
+   shifted by `LEAN_BRC_SHIFT` and the flags below. When the owner drops its last reference, it merges the two counters:
+   it sets `LEAN_BRC_MERGED`, and from then on all threads use `m_shared_rc` only.
+
+   When a non-owner decrement makes the shared counter negative, the owner may be holding the last references.
+   The object is then queued (`LEAN_BRC_QUEUED`) in the owner's queue, and the owner merges the counters
+   the next time it processes the queue: when it drops the last reference to one of its objects,
+   has dropped `LEAN_BRC_DRAIN_INTERVAL` other references, finishes running a task, blocks on a task,
+   calls `check_system` or `IO.checkCanceled`, sleeps, or exits. The object is freed only by whoever observes the merged counter reach zero
+   while the object is not queued.
+
+   Objects are biased only when marked by a thread that has an owner id; tasks and objects marked during
+   thread finalization use the plain atomic counter in `m_rc`. */
+#define LEAN_BRC_BIASED 1
+#define LEAN_BRC_MERGED 2
+#define LEAN_BRC_QUEUED 4
+#define LEAN_BRC_SHIFT  3
+#define LEAN_BRC_ONE    (1 << LEAN_BRC_SHIFT)
+#define LEAN_BRC_DRAIN_INTERVAL 4096
+
+struct brc_queue {
+    std::vector<object *> m_objs;
+    atomic<bool>          m_nonempty{false};
+};
+
+static mutex *                                    g_brc_mutex = nullptr;
+static std::unordered_map<unsigned, brc_queue *> * g_brc_queues = nullptr;
+static atomic<unsigned>                           g_brc_next_thread_id(1);
+/* Owner id of the current thread, `0` if not assigned yet or if the thread is being finalized. */
+LEAN_THREAD_VALUE(unsigned, g_brc_thread_id, 0);
+LEAN_THREAD_VALUE(bool, g_brc_finalized, false);
+LEAN_THREAD_PTR(brc_queue, g_brc_queue);
+/* Number of references to owned objects dropped by the current thread, see `LEAN_BRC_DRAIN_INTERVAL` */
+LEAN_THREAD_VALUE(unsigned, g_brc_num_decs, 0);
+
+static inline _Atomic(int) * brc_shared_rc_addr(object * o) {
+    return (_Atomic(int)*)(&(o->m_shared_rc));
+}
+
+static inline _Atomic(unsigned) * brc_owner_addr(object * o) {
+    return (_Atomic(unsigned)*)(&(o->m_owner));
+}
+
+static inline bool brc_is_biased(object * o) {
+    return std::atomic_load_explicit(brc_shared_rc_addr(o), std::memory_order_relaxed) & LEAN_BRC_BIASED;
+}
+
+static inline bool brc_is_owner(object * o) {
+    unsigned id = g_brc_thread_id;
+    return id != 0 && std::atomic_load_explicit(brc_owner_addr(o), std::memory_order_relaxed) == id;
+}
+
+static void del(object * o);
+
+/* Merge the owner's counter of `o` into the shared one and clear `LEAN_BRC_QUEUED`.
+   Must be executed by the owner, or by any thread if the owner has already merged the counters or has exited.
+   Return `true` if `o` must be freed. */
+static bool brc_merge(object * o) {
+    int n = -o->m_rc - 1;
+    int v = std::atomic_load_explicit(brc_shared_rc_addr(o), std::memory_order_relaxed);
+    int r;
+    do {
+        r = ((v & ~LEAN_BRC_QUEUED) + n * LEAN_BRC_ONE) | LEAN_BRC_MERGED;
+    } while (!std::atomic_compare_exchange_weak_explicit(brc_shared_rc_addr(o), &v, r, std::memory_order_acq_rel, std::memory_order_relaxed));
+    if (n != 0) {
+        o->m_rc = -1;
+        std::atomic_store_explicit(brc_owner_addr(o), 0u, std::memory_order_release);
+    }
+    return (r >> LEAN_BRC_SHIFT) == 0;
+}
+
+static void brc_process_objs(std::vector<object *> & objs) {
+    for (object * o : objs) {
+        if (brc_merge(o))
+            del(o);
+    }
+}
+
+/* Process the objects queued by other threads for the current thread. */
+static void brc_process_queue() {
+    brc_queue * q = g_brc_queue;
+    if (q == nullptr || !q->m_nonempty.load())
+        return;
+    std::vector<object *> objs;
+    {
+        unique_lock<mutex> lock(*g_brc_mutex);
+        objs.swap(q->m_objs);
+        q->m_nonempty.store(false);
+    }
+    brc_process_objs(objs);
+}
+
+/* Push `o` to its owner's queue. The caller has set `LEAN_BRC_QUEUED` in the same atomic operation that made the
+   shared counter negative, so `o` cannot be freed concurrently. */
+static void brc_enqueue(object * o) {
+    unsigned owner = std::atomic_load_explicit(brc_owner_addr(o), std::memory_order_acquire);
+    if (owner != 0) {
+        unique_lock<mutex> lock(*g_brc_mutex);
+        auto it = g_brc_queues->find(owner);
+        if (it != g_brc_queues->end()) {
+            it->second->m_objs.push_back(o);
+            it->second->m_nonempty.store(true);
+            return;
+        }
+    }
+    /* The counters have been merged concurrently, or the owner has exited. */
+    if (brc_merge(o))
+        del(o);
+}
+
+static void brc_finalize_thread(void *) {
+    brc_queue * q = g_brc_queue;
+    g_brc_finalized = true;
+    {
+        unique_lock<mutex> lock(*g_brc_mutex);
+        g_brc_queues->erase(g_brc_thread_id);
+    }
+    /* From now on, this thread updates its own objects through the shared counter and merges them itself when queued. */
+    g_brc_thread_id = 0;
+    g_brc_queue     = nullptr;
+    brc_process_objs(q->m_objs);
+    delete q;
+}
+
+/* Return the owner id of the current thread, allocating it on first use. */
+static unsigned brc_get_thread_id() {
+    if (LEAN_LIKELY(g_brc_thread_id != 0) || g_brc_finalized)
+        return g_brc_thread_id;
+    unsigned id = g_brc_next_thread_id++;
+    brc_queue * q = new brc_queue();
+    {
+        unique_lock<mutex> lock(*g_brc_mutex);
+        (*g_brc_queues)[id] = q;
+    }
+    g_brc_thread_id = id;
+    g_brc_queue     = q;
+    register_thread_finalizer(brc_finalize_thread, nullptr);
+    return id;
+}
+
+static inline void brc_inc_ref(object * o, int n) {
+    if (brc_is_owner(o))
+        o->m_rc -= n;
+    else
+        std::atomic_fetch_add_explicit(brc_shared_rc_addr(o), n * LEAN_BRC_ONE, std::memory_order_relaxed);
+}
+
+/* Return `true` if `o` must be freed. */
+static bool brc_dec_ref(object * o) {
+    if (brc_is_owner(o)) {
+        if (o->m_rc < -2) {
+            o->m_rc++;
+            if (LEAN_UNLIKELY(++g_brc_num_decs % LEAN_BRC_DRAIN_INTERVAL == 0))
+                brc_process_queue();
+            return false;
+        }
+        /* The owner dropped its last reference. If `o` is queued, it is freed when processing the queue. */
+        o->m_rc = -1;
+        int v = std::atomic_fetch_or_explicit(brc_shared_rc_addr(o), LEAN_BRC_MERGED, std::memory_order_acq_rel);
+        std::atomic_store_explicit(brc_owner_addr(o), 0u, std::memory_order_release);
+        brc_process_queue();
+        return (v >> LEAN_BRC_SHIFT) == 0 && !(v & LEAN_BRC_QUEUED);
+    }
+    /* Decrement and decide whether to queue `o` in a single step: once the owner has merged the counters,
+       a separate update could race with the thread freeing `o`. */
+    int v = std::atomic_load_explicit(brc_shared_rc_addr(o), std::memory_order_relaxed);
+    int r;
+    do {
+        r = v - LEAN_BRC_ONE;
+        if (!(v & (LEAN_BRC_MERGED | LEAN_BRC_QUEUED)) && (r >> LEAN_BRC_SHIFT) < 0)
+            r |= LEAN_BRC_QUEUED;
+    } while (!std::atomic_compare_exchange_weak_explicit(brc_shared_rc_addr(o), &v, r, std::memory_order_acq_rel, std::memory_order_relaxed));
+    if (v & LEAN_BRC_MERGED)
+        return (r >> LEAN_BRC_SHIFT) == 0 && !(r & LEAN_BRC_QUEUED);
+    if ((r & LEAN_BRC_QUEUED) && !(v & LEAN_BRC_QUEUED))
+        brc_enqueue(o);
+    return false;
+}
+#endif
+
+/* Decrement the RC of the multi threaded object `o`, and return `true` if it must be freed. */
+static inline bool dec_ref_mt(object * o) {
+#ifdef LEAN_BIASED_RC
+    if (brc_is_biased(o))
+        return brc_dec_ref(o);
+#endif
+    return std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1;
+}
+
 extern "C" LEAN_EXPORT void lean_inc_ref_cold(lean_object * o) {
+#ifdef LEAN_BIASED_RC
+    if (brc_is_biased(o))
+        return brc_inc_ref(o, 1);
+#endif
     std::atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_relaxed);
 }
 
 extern "C" LEAN_EXPORT void lean_inc_ref_n_cold(lean_object * o, unsigned n) {
+#ifdef LEAN_BIASED_RC
+    if (brc_is_biased(o))
+        return brc_inc_ref(o, (int)n);
+#endif
     std::atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), (int)n, std::memory_order_relaxed);
 }
 
@@ -276,7 +495,7 @@ static inline void dec(lean_object * o, lean_object* & todo) {
         push_back(todo, o);
     } else if (o->m_rc == 0) {
         return;
-    } else if (std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
+    } else if (dec_ref_mt(o)) {
         push_back(todo, o);
     }
 }
@@ -371,20 +590,118 @@ static void lean_del_core(object * o, object * & todo) {
     }
 }
 
-extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
-    if (o->m_rc == 1 || std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
+static void del(object * o) {
 #ifdef LEAN_LAZY_RC
-        push_back(g_to_free, o);
+    push_back(g_to_free, o);
 #else
-        object * todo = nullptr;
+    object * todo = nullptr;
+    while (true) {
+        lean_del_core(o, todo);
+        if (todo == nullptr)
+            return;
+        o = pop_back(todo);
+    }
+#endif
+}
+
+#if defined(LEAN_MULTI_THREAD) && !defined(LEAN_LAZY_RC)
+/* Background deallocation, enabled by setting the environment variable `LEAN_BACKGROUND_DEALLOC=1`.
+
+   A thread that frees a multi threaded object frees up to `LEAN_BG_DEALLOC_THRESHOLD` objects itself, and
+   then hands the rest of its deletion TODO list to a low priority reclaim thread. This is safe because objects
+   reachable from multi threaded objects are multi threaded or persistent, so their RCs are updated atomically.
+   Single threaded graphs are always freed synchronously since they may share objects with
+   the rest of the heap of the current thread.
+
+   At most `LEAN_BG_DEALLOC_MAX_QUEUED` TODO lists are queued; when the reclaim thread falls behind,
+   objects are freed synchronously again so that memory usage still goes down promptly. */
+#define LEAN_BG_DEALLOC_THRESHOLD  4096
+#define LEAN_BG_DEALLOC_MAX_QUEUED 16
+
+/* Read by all threads freeing objects, cleared by `finalize_object`. */
+static atomic<bool> g_bg_dealloc(false);
+
+class dealloc_thread {
+    mutex                    m_mutex;
+    condition_variable       m_cv;
+    std::vector<object *>    m_queue;
+    bool                     m_shutting_down = false;
+    std::unique_ptr<lthread> m_thread;
+
+    void run() {
+#if defined(__linux__)
+        /* Only affects the current thread on Linux. */
+        setpriority(PRIO_PROCESS, 0, 10);
+#endif
+        unique_lock<mutex> lock(m_mutex);
         while (true) {
-            lean_del_core(o, todo);
-            if (todo == nullptr)
+            m_cv.wait(lock, [&]() { return !m_queue.empty() || m_shutting_down; });
+            if (m_queue.empty())
                 return;
-            o = pop_back(todo);
+            object * todo = m_queue.back();
+            m_queue.pop_back();
+            lock.unlock();
+            while (todo != nullptr) {
+                object * o = pop_back(todo);
+                lean_del_core(o, todo);
+            }
+            lock.lock();
         }
-#endif
     }
+
+public:
+    /* Queue the deletion TODO list `todo`, and return `false` if the queue is full. */
+    bool push(object * todo) {
+        unique_lock<mutex> lock(m_mutex);
+        if (m_shutting_down || m_queue.size() >= LEAN_BG_DEALLOC_MAX_QUEUED)
+            return false;
+        if (!m_thread)
+            m_thread.reset(new lthread([this]() { run(); }));
+        m_queue.push_back(todo);
+        m_cv.notify_one();
+        return true;
+    }
+
+    /* Free all queued objects and stop the reclaim thread. Later calls to `push` fail. */
+    void shutdown() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_shutting_down = true;
+            m_cv.notify_one();
+        }
+        if (m_thread)
+            m_thread->join();
+    }
+};
+
+static dealloc_thread * g_dealloc_thread = nullptr;
+
+/* Free the multi threaded object `o`, whose RC has reached zero. */
+static void del_mt(object * o) {
+    if (!g_bg_dealloc.load(std::memory_order_acquire))
+        return del(o);
+    object * todo = nullptr;
+    unsigned n = 0;
+    while (true) {
+        lean_del_core(o, todo);
+        if (todo == nullptr)
+            return;
+        if (++n >= LEAN_BG_DEALLOC_THRESHOLD && g_dealloc_thread->push(todo))
+            return;
+        o = pop_back(todo);
+    }
+}
+#else
+static void del_mt(object * o) {
+    del(o);
+}
+#endif
+
+extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
+    if (o->m_rc == 1)
+        del(o);
+    else if (dec_ref_mt(o))
+        del_mt(o);
 }
 
 
@@ -438,6 +755,28 @@ extern "C" LEAN_EXPORT lean_obj_res lean_array_set_panic(lean_obj_arg a, lean_ob
 // =======================================
 // Thunks
 
+/* Threads forcing a thunk that is already being evaluated by another thread first spin for a
+   bounded, adaptively adjusted number of rounds, and then park on a condition variable selected
+   by hashing the address of the thunk. */
+#define LEAN_THUNK_WAIT_BUCKETS 64
+#define LEAN_THUNK_MIN_SPIN     4
+#define LEAN_THUNK_MAX_SPIN     256
+
+struct thunk_wait_bucket {
+    mutex              m_mutex;
+    condition_variable m_cv;
+    atomic<unsigned>   m_num_waiters{0};
+};
+
+static thunk_wait_bucket * g_thunk_wait_buckets = nullptr;
+static atomic<unsigned>    g_thunk_spin_limit(LEAN_THUNK_MAX_SPIN / 4);
+
+static thunk_wait_bucket & get_thunk_wait_bucket(b_obj_arg t) {
+    return g_thunk_wait_buckets[(reinterpret_cast<size_t>(t) / sizeof(lean_thunk_object)) % LEAN_THUNK_WAIT_BUCKETS];
+}
+
+static void wait_for_thunk(b_obj_arg t);
+
 extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
     object * c = lean_to_thunk(t)->m_closure.exchange(nullptr);
     if (c != nullptr) {
@@ -453,14 +792,20 @@ extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
         lean_assert(lean_to_thunk(t)->m_value == nullptr);
         mark_mt(r);
         lean_to_thunk(t)->m_value = r;
+        /* Waiters increment `m_num_waiters` before checking `m_value` and going to sleep, so either they
+           see the value or we see them. */
+        thunk_wait_bucket & b = get_thunk_wait_bucket(t);
+        if (b.m_num_waiters > 0) {
+            lock_guard<mutex> lock(b.m_mutex);
+            b.m_cv.notify_all();
+        }
         return r;
     } else {
         lean_assert(c == nullptr);
         /* There is another thread executing the closure. We keep waiting for the m_value to be
            set by another thread. */
-        while (!lean_to_thunk(t)->m_value) {
-            this_thread::yield();
-        }
+        if (!lean_to_thunk(t)->m_value)
+            wait_for_thunk(t);
         return lean_to_thunk(t)->m_value;
     }
 }
@@ -555,74 +900,297 @@ extern "C" LEAN_EXPORT void lean_mark_persistent(object * o) {
 
 extern "C" void lean_mark_mt(object * o);
 
+static uint64_t task_clock_ns();
+static void record_mark_mt_event(uint64_t start, uint64_t end, uint64_t num_objs);
+
+/* Whether task manager events are recorded, see `IO.setTaskTracing`. */
+static atomic_bool g_task_tracing(false);
+
+/* `lean_mark_mt` statistics, see `IO.TaskManagerStats`. They are only collected while `g_task_tracing` is set. */
+static atomic<uint64_t> g_mark_mt_calls(0);
+static atomic<uint64_t> g_mark_mt_objs(0);
+static atomic<uint64_t> g_mark_mt_max_objs(0);
+static atomic<uint64_t> g_mark_mt_ns(0);
+
+/* Number of objects `lean_mark_mt` marks on the calling thread before splitting the remaining work
+   across helper tasks. */
+#define LEAN_MARK_MT_PAR_THRESHOLD (64*1024)
+/* Number of objects a helper marks between checks for idle helpers to share work with. */
+#define LEAN_MARK_MT_CHUNK 256
+#define LEAN_MARK_MT_MAX_HELPERS 8u
+
+struct mark_mt_state {
+    std::vector<object *> m_todo;
+    /* Owner of the marked objects when using biased reference counting, `0` if none. */
+    unsigned              m_owner = 0;
+    /* Whether other threads are marking the same graph. Then objects are marked using atomic operations,
+       and external objects are collected in `m_externals` instead of being traversed, since
+       `m_foreach` updates the RC of their children non-atomically. */
+    bool                  m_concurrent = false;
+    std::vector<object *> m_externals;
+    uint64_t              m_num_marked = 0;
+};
+
+/* State of the `lean_mark_mt` call running on the current thread, if any. */
+LEAN_THREAD_PTR(mark_mt_state, g_mark_mt_state);
+
 static obj_res mark_mt_fn(obj_arg o) {
-    lean_mark_mt(o);
+    if (mark_mt_state * s = g_mark_mt_state)
+        s->m_todo.push_back(o);
+    else
+        lean_mark_mt(o);
     lean_dec(o);
     return lean_box(0);
 }
 
+/* Mark `o` as multi threaded, and return `false` if it was not single threaded. */
+static inline bool mark_mt_obj(object * o, mark_mt_state & s) {
+    int rc;
+    if (s.m_concurrent) {
+        rc = std::atomic_load_explicit(lean_get_rc_mt_addr(o), std::memory_order_relaxed);
+        do {
+            if (rc <= 0)
+                return false;
+        } while (!std::atomic_compare_exchange_weak_explicit(lean_get_rc_mt_addr(o), &rc, s.m_owner != 0 ? -rc - 1 : -rc,
+                                                             std::memory_order_relaxed, std::memory_order_relaxed));
+    } else {
+        rc = o->m_rc;
+        if (rc <= 0)
+            return false;
+        o->m_rc = s.m_owner != 0 ? -rc - 1 : -rc;
+    }
+#ifdef LEAN_BIASED_RC
+    o->m_owner     = s.m_owner;
+    o->m_shared_rc = s.m_owner != 0 ? LEAN_BRC_BIASED : 0;
+#endif
+    return true;
+}
+
+static void mark_mt_push_children(object * o, mark_mt_state & s) {
+    std::vector<object *> & todo = s.m_todo;
+    uint8_t tag = lean_ptr_tag(o);
+    if (tag <= LeanMaxCtorTag) {
+        object ** it  = lean_ctor_obj_cptr(o);
+        object ** end = it + lean_ctor_num_objs(o);
+        for (; it != end; ++it) todo.push_back(*it);
+    } else {
+        switch (tag) {
+        case LeanScalarArray:
+        case LeanString:
+        case LeanMPZ:
+            break;
+        case LeanExternal: {
+            if (s.m_concurrent) {
+                s.m_externals.push_back(o);
+                break;
+            }
+            object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
+            lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
+            lean_dec(fn);
+            break;
+        }
+        case LeanTask:
+            todo.push_back(lean_task_get(o));
+            break;
+        case LeanPromise:
+            todo.push_back((lean_object *)lean_to_promise(o)->m_result);
+            break;
+        case LeanClosure: {
+            object ** it  = lean_closure_arg_cptr(o);
+            object ** end = it + lean_closure_num_fixed(o);
+            for (; it != end; ++it) todo.push_back(*it);
+            break;
+        }
+        case LeanArray: {
+            object ** it  = lean_array_cptr(o);
+            object ** end = it + lean_array_size(o);
+            for (; it != end; ++it) todo.push_back(*it);
+            break;
+        }
+        case LeanThunk:
+            if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
+            if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
+            break;
+        case LeanRef:
+            if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
+            break;
+        default:
+            lean_unreachable();
+            break;
+        }
+    }
+}
+
+/* Mark objects reachable from `s.m_todo` until `s.m_num_marked` reaches `limit`. */
+static void mark_mt_loop(mark_mt_state & s, uint64_t limit) {
+    while (!s.m_todo.empty() && s.m_num_marked < limit) {
+        object * o = s.m_todo.back();
+        s.m_todo.pop_back();
+        if (!lean_is_scalar(o) && mark_mt_obj(o, s)) {
+            s.m_num_marked++;
+            mark_mt_push_children(o, s);
+        }
+    }
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Work shared by the helpers of a parallel `lean_mark_mt`. It is wrapped in an external object owned by the
+   helper tasks, which may start running only after marking has finished, see `mark_mt_par`. */
+struct mark_mt_pool {
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    std::vector<object *> m_todo;
+    unsigned              m_owner = 0;
+    /* States of the participating helpers. Helper tasks that start after marking has finished do not participate. */
+    std::vector<std::unique_ptr<mark_mt_state>> m_states;
+    unsigned              m_num_helpers = 0;
+    atomic<unsigned>      m_num_idle{0};
+    bool                  m_done = false;
+};
+
+static lean_external_class * g_mark_mt_pool_class = nullptr;
+
+static void mark_mt_pool_finalizer(void * p) {
+    delete static_cast<mark_mt_pool *>(p);
+}
+
+static void mark_mt_pool_foreach(void *, b_obj_arg) {}
+
+/* Add a participant to `p`. Must be called while holding `p.m_mutex`, before marking has finished. */
+static mark_mt_state * mark_mt_join(mark_mt_pool & p) {
+    lean_assert(!p.m_done);
+    mark_mt_state * s = new mark_mt_state();
+    s->m_owner      = p.m_owner;
+    s->m_concurrent = true;
+    p.m_states.emplace_back(s);
+    p.m_num_helpers++;
+    return s;
+}
+
+static void mark_mt_helper(mark_mt_pool & p, mark_mt_state & s) {
+    while (true) {
+        if (s.m_todo.empty()) {
+            unique_lock<mutex> lock(p.m_mutex);
+            p.m_num_idle++;
+            while (p.m_todo.empty() && !p.m_done) {
+                if (p.m_num_idle == p.m_num_helpers) {
+                    p.m_done = true;
+                    p.m_cv.notify_all();
+                } else {
+                    p.m_cv.wait(lock);
+                }
+            }
+            if (p.m_done)
+                return;
+            p.m_num_idle--;
+            size_t n = std::min<size_t>(p.m_todo.size(), LEAN_MARK_MT_CHUNK);
+            s.m_todo.insert(s.m_todo.end(), p.m_todo.end() - n, p.m_todo.end());
+            p.m_todo.resize(p.m_todo.size() - n);
+        }
+        mark_mt_loop(s, s.m_num_marked + LEAN_MARK_MT_CHUNK);
+        if (s.m_todo.size() > 1 && p.m_num_idle > 0) {
+            /* Share the oldest half of our work, which is closer to the roots and thus likely to lead to larger subgraphs. */
+            size_t n = s.m_todo.size() / 2;
+            unique_lock<mutex> lock(p.m_mutex);
+            p.m_todo.insert(p.m_todo.end(), s.m_todo.begin(), s.m_todo.begin() + n);
+            s.m_todo.erase(s.m_todo.begin(), s.m_todo.begin() + n);
+            p.m_cv.notify_all();
+        }
+    }
+}
+
+static obj_res mark_mt_helper_fn(obj_arg pool, obj_arg) {
+    mark_mt_pool & p = *static_cast<mark_mt_pool *>(lean_get_external_data(pool));
+    mark_mt_state * s = nullptr;
+    {
+        unique_lock<mutex> lock(p.m_mutex);
+        if (!p.m_done)
+            s = mark_mt_join(p);
+    }
+    if (s)
+        mark_mt_helper(p, *s);
+    lean_dec(pool);
+    return lean_box(0);
+}
+
+/* Mark the objects reachable from `s.m_todo` together with helper tasks on the task manager. Children of external
+   objects are left in `s.m_todo`. Return `false` if the task manager has fewer than two workers.
+
+   Marking is finished as soon as all participants are idle. The calling thread participates from the start, while
+   each helper task joins when a worker picks it up, so marking never waits for a busy pool. Helper tasks that have
+   not started by then are dropped. */
+static bool mark_mt_par(mark_mt_state & s) {
+    unsigned n = std::min(get_task_manager_num_workers(), LEAN_MARK_MT_MAX_HELPERS);
+    if (n < 2)
+        return false;
+    mark_mt_pool * p = new mark_mt_pool();
+    object * pool = lean_alloc_external(g_mark_mt_pool_class, p);
+    p->m_owner = s.m_owner;
+    p->m_todo.swap(s.m_todo);
+    mark_mt_state * self;
+    {
+        unique_lock<mutex> lock(p->m_mutex);
+        self = mark_mt_join(*p);
+    }
+    std::vector<object *> tasks;
+    for (unsigned i = 1; i < n; i++) {
+        object * c = lean_alloc_closure((void*)mark_mt_helper_fn, 2, 1);
+        lean_inc(pool);
+        lean_closure_set(c, 0, pool);
+        tasks.push_back(lean_task_spawn_core(c, LEAN_MAX_PRIO, false));
+    }
+    mark_mt_helper(*p, *self);
+    for (object * t : tasks)
+        lean_dec(t);
+    for (std::unique_ptr<mark_mt_state> & h : p->m_states) {
+        s.m_num_marked += h->m_num_marked;
+        for (object * o : h->m_externals) {
+            object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
+            lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
+            lean_dec(fn);
+        }
+    }
+    lean_dec(pool);
+    return true;
+}
+#endif
+
 extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
 #ifndef LEAN_MULTI_THREAD
     return;
-#endif
+#else
     if (lean_is_scalar(o) || !lean_is_st(o)) return;
 
-    buffer<object*> todo;
-    todo.push_back(o);
-    while (!todo.empty()) {
-        object * o = todo.back();
-        todo.pop_back();
-        if (!lean_is_scalar(o) && lean_is_st(o)) {
-            o->m_rc = -o->m_rc;
-            uint8_t tag = lean_ptr_tag(o);
-            if (tag <= LeanMaxCtorTag) {
-                object ** it  = lean_ctor_obj_cptr(o);
-                object ** end = it + lean_ctor_num_objs(o);
-                for (; it != end; ++it) todo.push_back(*it);
-            } else {
-                switch (tag) {
-                case LeanScalarArray:
-                case LeanString:
-                case LeanMPZ:
-                    break;
-                case LeanExternal: {
-                    object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
-                    lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
-                    lean_dec(fn);
-                    break;
-                }
-                case LeanTask:
-                    todo.push_back(lean_task_get(o));
-                    break;
-                case LeanPromise:
-                    todo.push_back((lean_object *)lean_to_promise(o)->m_result);
-                    break;
-                case LeanClosure: {
-                    object ** it  = lean_closure_arg_cptr(o);
-                    object ** end = it + lean_closure_num_fixed(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanArray: {
-                    object ** it  = lean_array_cptr(o);
-                    object ** end = it + lean_array_size(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanThunk:
-                    if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
-                    if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
-                    break;
-                case LeanRef:
-                    if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
-                    break;
-                default:
-                    lean_unreachable();
-                    break;
-                }
-            }
+    bool stats = g_task_tracing.load(std::memory_order_relaxed);
+    uint64_t start = stats ? task_clock_ns() : 0;
+    mark_mt_state s;
+#ifdef LEAN_BIASED_RC
+    /* Do not process the queue here: `lean_mark_mt` may be called while holding the task manager lock,
+       and freeing a queued task would take it again. */
+    s.m_owner = brc_get_thread_id();
+#endif
+    {
+        flet<mark_mt_state *> set(g_mark_mt_state, &s);
+        s.m_todo.push_back(o);
+        while (true) {
+            /* Small graphs are marked on the current thread. */
+            mark_mt_loop(s, s.m_num_marked + LEAN_MARK_MT_PAR_THRESHOLD);
+            if (s.m_todo.empty())
+                break;
+            if (!mark_mt_par(s))
+                mark_mt_loop(s, std::numeric_limits<uint64_t>::max());
         }
     }
+    if (stats) {
+        uint64_t end = task_clock_ns();
+        g_mark_mt_calls++;
+        g_mark_mt_objs += s.m_num_marked;
+        g_mark_mt_ns   += end - start;
+        uint64_t max = g_mark_mt_max_objs;
+        while (max < s.m_num_marked && !g_mark_mt_max_objs.compare_exchange_weak(max, s.m_num_marked)) {}
+        record_mark_mt_event(start, end, s.m_num_marked);
+    }
+#endif
 }
 
 // =======================================
@@ -635,6 +1203,8 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
     imp->m_closure     = c;
     imp->m_head_dep    = nullptr;
     imp->m_next_dep    = nullptr;
+    imp->m_waiters     = nullptr;
+    imp->m_queue_time  = 0;
     imp->m_prio        = prio;
     imp->m_canceled    = false;
     imp->m_keep_alive  = keep_alive;
@@ -655,55 +1225,261 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
-class task_manager {
+/* A thread blocked on one or more tasks. Each blocked thread has its own condition variable so
+   that finishing a task wakes exactly the threads waiting for it. */
+struct task_waiter {
+    condition_variable m_cv;
+    bool               m_woken{false};
+
+    void add_to(lean_task_object * t, lean_task_waiter & r) {
+        lean_assert(t->m_imp);
+        r.m_waiter = this;
+        r.m_next   = t->m_imp->m_waiters;
+        r.m_prev   = &t->m_imp->m_waiters;
+        if (r.m_next)
+            r.m_next->m_prev = &r.m_next;
+        t->m_imp->m_waiters = &r;
+    }
+
+    static void remove(lean_task_waiter & r) {
+        if (!r.m_prev)
+            return;
+        *r.m_prev = r.m_next;
+        if (r.m_next)
+            r.m_next->m_prev = r.m_prev;
+        r.m_prev = nullptr;
+    }
+};
+
+// =======================================
+// Task manager telemetry
+
+static uint64_t task_clock_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum class task_event_kind : uint8_t { Run, Blocked, MarkMt };
+
+struct task_event {
+    task_event_kind m_kind;
+    unsigned        m_prio;
+    /* Time spent queued before a `Run` event, in nanoseconds, or number of objects marked by a `MarkMt` event */
+    uint64_t        m_queued;
+    uint64_t        m_start;
+    uint64_t        m_end;
+};
+
+/* Events recorded by a single thread. Buffers are kept alive until finalization so that events of
+   threads that have already terminated can still be exported. */
+struct task_event_buffer {
+    mutex                   m_mutex;
+    std::string             m_name;
+    std::vector<task_event> m_events;
+};
+
+static uint64_t                           g_task_tracing_start = 0;
+static mutex *                            g_task_event_buffers_mutex = nullptr;
+static std::vector<task_event_buffer *> * g_task_event_buffers = nullptr;
+LEAN_THREAD_PTR(task_event_buffer, g_task_event_buffer);
+
+static void record_task_event(task_event_kind kind, unsigned prio, uint64_t queued, uint64_t start, uint64_t end);
+
+static void record_blocked_event(uint64_t start) {
+    if (g_task_tracing)
+        record_task_event(task_event_kind::Blocked, 0, 0, start, task_clock_ns());
+}
+
+/* Sets the `lean_mark_mt` fields of an `IO.TaskManagerStats` value. */
+static void set_mark_mt_stats(object * r) {
+    lean_ctor_set(r, 10, lean_uint64_to_nat(g_mark_mt_calls));
+    lean_ctor_set(r, 11, lean_uint64_to_nat(g_mark_mt_objs));
+    lean_ctor_set(r, 12, lean_uint64_to_nat(g_mark_mt_max_objs));
+    lean_ctor_set(r, 13, lean_uint64_to_nat(g_mark_mt_ns));
+}
+
+static void record_mark_mt_event(uint64_t start, uint64_t end, uint64_t num_objs) {
+    if (g_task_tracing)
+        record_task_event(task_event_kind::MarkMt, 0, num_objs, start, end);
+}
+
+/* Run queue with one deque per priority class. Every standard worker owns one; the owner pushes
+   and pops at the back (LIFO), which keeps freshly spawned and usually cache-hot work local, while
+   other workers steal from the front (FIFO), which takes the oldest work first. Tasks enqueued from
+   threads outside the pool go into `task_manager::m_inject_queue`. */
+struct task_queue {
     mutex                                         m_mutex;
-    std::vector<std::unique_ptr<lthread>>         m_std_workers;
-    unsigned                                      m_idle_std_workers{0};
-    unsigned                                      m_max_std_workers{0};
-    unsigned                                      m_num_dedicated_workers{0};
     std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
-    condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
-    bool                                          m_shutting_down{false};
+    /* Number of queued tasks and highest priority of a nonempty deque. Only modified while holding
+       `m_mutex`, but read without it to pick a queue to pop from. */
+    atomic<unsigned>                              m_size{0};
+    atomic<unsigned>                              m_max_prio{0};
+    /* Next queue in `task_manager::m_worker_queues`, immutable after publication. */
+    task_queue *                                  m_next{nullptr};
+
+    void push(lean_task_object * const * ts, size_t n, unsigned prio) {
+        lock_guard<mutex> lock(m_mutex);
+        m_queues[prio].insert(m_queues[prio].end(), ts, ts + n);
+        if (m_size == 0 || prio > m_max_prio)
+            m_max_prio = prio;
+        m_size += n;
+    }
 
-    lean_task_object * dequeue() {
-        lean_assert(m_queues_size != 0);
-        std::deque<lean_task_object *> & q = m_queues[m_max_prio];
+    lean_task_object * pop(bool owner) {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_size == 0)
+            return nullptr;
+        unsigned prio = m_max_prio;
+        std::deque<lean_task_object *> & q = m_queues[prio];
         lean_assert(!q.empty());
-        lean_task_object * result      = q.front();
-        q.pop_front();
-        m_queues_size--;
+        lean_task_object * result;
+        if (owner) {
+            result = q.back();
+            q.pop_back();
+        } else {
+            result = q.front();
+            q.pop_front();
+        }
+        m_size--;
         if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
+            while (prio > 0) {
+                --prio;
+                if (!m_queues[prio].empty())
                     break;
             }
+            m_max_prio = prio;
         }
         return result;
     }
+};
 
-    void enqueue_core(unique_lock<mutex> & lock, lean_task_object * t) {
-        lean_assert(t->m_imp);
-        unsigned prio = t->m_imp->m_prio;
-        if (prio == LEAN_SYNC_PRIO) {
-            run_task(lock, t);
+/* Run queue of the current standard worker thread, if any. */
+LEAN_THREAD_PTR(task_queue, g_worker_queue);
+
+/* The task manager uses two kinds of locks:
+   * `m_mutex` protects task state, i.e. the `m_imp` fields of tasks, dependency lists, and the publication of
+     `m_value`. Run queues are *not* protected by it, so spawning a task does not acquire it.
+   * `m_idle_mutex` protects the set of standard workers and is used by idle workers to sleep on `m_queue_cv`.
+   The lock order is `m_mutex` < `task_queue::m_mutex` < `m_idle_mutex`. */
+class task_manager {
+    mutex                                         m_mutex;
+    mutex                                         m_idle_mutex;
+    std::vector<std::unique_ptr<lthread>>         m_std_workers;
+    atomic<unsigned>                              m_num_std_workers{0};
+    atomic<unsigned>                              m_sleeping_std_workers{0};
+    atomic<unsigned>                              m_active_std_workers{0};
+    atomic<unsigned>                              m_max_std_workers{0};
+    atomic<unsigned>                              m_num_dedicated_workers{0};
+    task_queue                                    m_inject_queue;
+    atomic<task_queue *>                          m_worker_queues{nullptr};
+    /* Total number of tasks in all run queues. Incremented before a task is pushed, so it may briefly
+       overapproximate the number of tasks that can be popped. */
+    atomic<unsigned>                              m_queues_size{0};
+    condition_variable                            m_queue_cv;
+    atomic_bool                                   m_shutting_down{false};
+    /* Statistics, see `IO.getTaskManagerStats` */
+    atomic<unsigned>                              m_num_queued[LEAN_MAX_PRIO+1];
+    atomic<uint64_t>                              m_num_tasks_run{0};
+    atomic<uint64_t>                              m_num_blocked_workers{0};
+    atomic<uint64_t>                              m_queued_ns{0};
+    atomic<uint64_t>                              m_run_ns{0};
+    atomic<uint64_t>                              m_idle_ns{0};
+
+    /* Pop the queued task of highest priority, preferring the current worker's own queue, then the
+       injection queue, then stealing from other workers. May spuriously return `nullptr` when racing
+       with other workers. */
+    lean_task_object * dequeue() {
+        task_queue * self = g_worker_queue;
+        task_queue * best = nullptr;
+        unsigned best_prio = 0;
+        auto consider = [&](task_queue * q) {
+            if (q->m_size > 0) {
+                unsigned prio = q->m_max_prio;
+                if (!best || prio > best_prio) {
+                    best      = q;
+                    best_prio = prio;
+                }
+            }
+        };
+        if (self)
+            consider(self);
+        consider(&m_inject_queue);
+        for (task_queue * q = m_worker_queues; q; q = q->m_next) {
+            if (q != self)
+                consider(q);
+        }
+        if (!best)
+            return nullptr;
+        lean_task_object * result = best->pop(best == self);
+        if (result) {
+            m_queues_size--;
+            m_num_queued[result->m_imp->m_prio]--;
+        }
+        return result;
+    }
+
+    /* Reserve one of `m_max_std_workers` slots for running a task. */
+    bool try_activate_std_worker() {
+        unsigned n = m_active_std_workers;
+        while (n < m_max_std_workers) {
+            if (m_active_std_workers.compare_exchange_strong(n, n + 1))
+                return true;
+        }
+        return false;
+    }
+
+    /* Make sure enough workers will pick up `n` newly queued tasks. */
+    void wake_workers(size_t n) {
+        // Every worker sleeping on `m_queue_cv` first increments `m_sleeping_std_workers` and then checks
+        // `m_queues_size`, so either it sees the new tasks or we see it.
+        if (m_sleeping_std_workers == 0 && m_num_std_workers >= m_max_std_workers)
             return;
+        unique_lock<mutex> lock(m_idle_mutex);
+        unsigned sleeping = m_sleeping_std_workers;
+        if (n >= sleeping) {
+            m_queue_cv.notify_all();
+            n -= sleeping;
+        } else {
+            for (size_t i = 0; i < n; i++)
+                m_queue_cv.notify_one();
+            n = 0;
+        }
+        for (; n > 0 && m_num_std_workers < m_max_std_workers; n--)
+            spawn_worker(lock);
+    }
+
+    /* Queue `n` tasks of the same priority at once. */
+    void push_tasks(lean_task_object * const * ts, size_t n) {
+        if (n == 0)
+            return;
+        unsigned prio = ts[0]->m_imp->m_prio;
+        uint64_t now  = task_clock_ns();
+        for (size_t i = 0; i < n; i++) {
+            lean_assert(ts[i]->m_imp->m_prio == prio);
+            ts[i]->m_imp->m_queue_time = now;
         }
         if (prio > LEAN_MAX_PRIO) {
-            spawn_dedicated_worker(t);
+            for (size_t i = 0; i < n; i++)
+                spawn_dedicated_worker(ts[i]);
             return;
         }
-        if (prio > m_max_prio)
-            m_max_prio = prio;
-        m_queues[prio].push_back(t);
-        m_queues_size++;
-        if (!m_idle_std_workers && m_std_workers.size() < m_max_std_workers)
-            spawn_worker();
-        else
-            m_queue_cv.notify_one();
+        task_queue * q = g_worker_queue ? g_worker_queue : &m_inject_queue;
+        m_num_queued[prio] += n;
+        m_queues_size += n;
+        q->push(ts, n, prio);
+        wake_workers(n);
+    }
+
+    void push_task(lean_task_object * t) {
+        push_tasks(&t, 1);
+    }
+
+    void enqueue_core(unique_lock<mutex> & lock, lean_task_object * t) {
+        lean_assert(t->m_imp);
+        if (t->m_imp->m_prio == LEAN_SYNC_PRIO) {
+            run_task(lock, t);
+            return;
+        }
+        push_task(t);
     }
 
     void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
@@ -724,34 +1500,46 @@ class task_manager {
         lock.lock();
     }
 
-    void spawn_worker() {
+    void spawn_worker(unique_lock<mutex> &) {
         if (m_shutting_down)
             return;
 
-        m_std_workers.emplace_back(new lthread([this]() {
+        task_queue * q = new task_queue();
+        q->m_next = m_worker_queues;
+        m_worker_queues = q;
+        m_num_std_workers++;
+        m_std_workers.emplace_back(new lthread([this, q]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            m_idle_std_workers++;
+            g_worker_queue = q;
             while (true) {
+                if (m_queues_size > 0 && try_activate_std_worker()) {
+                    if (lean_task_object * t = dequeue()) {
+                        unique_lock<mutex> lock(m_mutex);
+                        run_task(lock, t);
+                        lock.unlock();
+                        reset_heartbeat();
+                    }
+                    m_active_std_workers--;
+                    continue;
+                }
+                unique_lock<mutex> lock(m_idle_mutex);
+                m_sleeping_std_workers++;
                 if (m_queues_size == 0 && m_shutting_down) {
+                    m_sleeping_std_workers--;
                     break;
                 }
                 if (m_queues_size == 0 ||
                         // If we have reached the maximum number of standard workers (because the
                         // maximum was decreased by `task_get`), wait for someone else to become
                         // idle before picking up new work.
-                        m_std_workers.size() - m_idle_std_workers >= m_max_std_workers) {
+                        m_active_std_workers >= m_max_std_workers) {
+                    uint64_t start = task_clock_ns();
                     m_queue_cv.wait(lock);
-                    continue;
+                    m_idle_ns += task_clock_ns() - start;
                 }
-
-                lean_task_object * t = dequeue();
-                m_idle_std_workers--;
-                run_task(lock, t);
-                m_idle_std_workers++;
-                reset_heartbeat();
+                m_sleeping_std_workers--;
             }
-            m_idle_std_workers--;
+            g_worker_queue = nullptr;
         }));
     }
 
@@ -778,12 +1566,29 @@ class task_manager {
             scoped_current_task_object scope_cur_task(t);
             object * c = t->m_imp->m_closure;
             t->m_imp->m_closure = nullptr;
+            unsigned prio = t->m_imp->m_prio;
+            uint64_t queue_time = t->m_imp->m_queue_time;
             lock.unlock();
+            uint64_t start = task_clock_ns();
             v = lean_apply_1(c, box(0));
+            uint64_t end = task_clock_ns();
+            uint64_t queued = queue_time ? start - queue_time : 0;
+            m_num_tasks_run++;
+            m_queued_ns += queued;
+            m_run_ns += end - start;
+            if (g_task_tracing)
+                record_task_event(task_event_kind::Run, prio, queued, start, end);
             // If deactivation was delayed by `m_keep_alive`, deactivate after the final execution (`v != nulltpr`)
             if (v != nullptr && t->m_imp->m_keep_alive) {
                 lean_dec_ref((lean_object*)t);
             }
+            /* `resolve_core` requires `v` to be marked, which must not happen under `m_mutex`: parallel marking
+               spawns helper tasks. */
+            if (v != nullptr)
+                mark_mt(v);
+#ifdef LEAN_BIASED_RC
+            brc_process_queue();
+#endif
             lock.lock();
         }
         lean_assert(t->m_imp);
@@ -807,16 +1612,34 @@ class task_manager {
         }
     }
 
+    /* `v` must have been marked as multi-threaded before taking `m_mutex`. */
     void resolve_core(unique_lock<mutex> & lock, lean_task_object * t, object * v) {
-        mark_mt(v);
+        lean_assert(lean_is_scalar(v) || !lean_is_st(v));
         t->m_value = v;
         lean_task_imp * imp = t->m_imp;
         t->m_imp   = nullptr;
+        /* Wake waiters before `handle_finished`, which may temporarily release the lock, after which
+           a waiter observing `m_value` may return and invalidate its registration. */
+        wake_waiters(imp);
         handle_finished(lock, t, imp);
         /* After the task has been finished and we propagated
            dependencies, we can release `imp` and keep just the value */
         free_task_imp(imp);
-        m_task_finished_cv.notify_all();
+    }
+
+    void wake_waiters(lean_task_imp * imp) {
+        lean_task_waiter * it = imp->m_waiters;
+        imp->m_waiters = nullptr;
+        while (it) {
+            lean_task_waiter * next_it = it->m_next;
+            it->m_prev = nullptr;
+            task_waiter * w = it->m_waiter;
+            if (!w->m_woken) {
+                w->m_woken = true;
+                w->m_cv.notify_one();
+            }
+            it = next_it;
+        }
     }
 
     void handle_finished(unique_lock<mutex> & lock, lean_task_object * t, lean_task_imp * imp) {
@@ -850,11 +1673,13 @@ class task_manager {
 public:
     task_manager(unsigned max_std_workers):
         m_max_std_workers(max_std_workers) {
+        for (atomic<unsigned> & n : m_num_queued)
+            n = 0;
     }
 
     ~task_manager() {
         {
-            unique_lock<mutex> lock(m_mutex);
+            unique_lock<mutex> lock(m_idle_mutex);
             m_shutting_down = true;
             // we can assume that `m_std_workers` will not be changed after this line
         }
@@ -863,13 +1688,29 @@ public:
         // wait for all workers to finish
         for (auto & t : m_std_workers)
             t->join();
+        task_queue * q = m_worker_queues;
+        while (q) {
+            task_queue * next = q->m_next;
+            delete q;
+            q = next;
+        }
         // never seems to terminate under Emscripten
 #endif
     }
 
+    void enqueue_many(lean_task_object * const * ts, size_t n) {
+        lean_assert(n == 0 || ts[0]->m_imp->m_prio != LEAN_SYNC_PRIO);
+        push_tasks(ts, n);
+    }
+
     void enqueue(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
-        enqueue_core(lock, t);
+        lean_assert(t->m_imp);
+        if (t->m_imp->m_prio == LEAN_SYNC_PRIO) {
+            unique_lock<mutex> lock(m_mutex);
+            enqueue_core(lock, t);
+        } else {
+            push_task(t);
+        }
     }
 
     void resolve(lean_task_object * t, object * v) {
@@ -877,6 +1718,7 @@ public:
             dec(v);
             return;
         }
+        mark_mt(v);
         unique_lock<mutex> lock(m_mutex);
         if (t->m_value) {
             lock.unlock(); // `dec(v)` could lead to `deactivate_task` trying to take the lock
@@ -905,19 +1747,41 @@ public:
     void wait_for(lean_task_object * t) {
         if (t->m_value)
             return;
+#ifdef LEAN_BIASED_RC
+        brc_process_queue();
+#endif
         unique_lock<mutex> lock(m_mutex);
         if (t->m_value)
             return;
-        // see `Task.get`
+        bool in_pool = begin_blocking();
+        uint64_t start = task_clock_ns();
+        task_waiter w;
+        lean_task_waiter r;
+        w.add_to(t, r);
+        w.m_cv.wait(lock, [&]() { return w.m_woken; });
+        lean_assert(t->m_value != nullptr);
+        end_blocking(in_pool);
+        record_blocked_event(start);
+    }
+
+    /* Called before the current thread blocks. If it is a standard worker, temporarily raise the
+       maximum number of standard workers so that the pool keeps making progress (see `Task.get`).
+       Returns whether it did so. */
+    bool begin_blocking() {
         bool in_pool = g_current_task_object && g_current_task_object->m_imp->m_prio <= LEAN_MAX_PRIO;
         if (in_pool) {
+            m_num_blocked_workers++;
+            unique_lock<mutex> idle_lock(m_idle_mutex);
             m_max_std_workers++;
-            if (m_idle_std_workers == 0)
-                spawn_worker();
+            if (m_sleeping_std_workers == 0)
+                spawn_worker(idle_lock);
             else
                 m_queue_cv.notify_one();
         }
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        return in_pool;
+    }
+
+    void end_blocking(bool in_pool) {
         if (in_pool) {
             m_max_std_workers--;
         }
@@ -927,11 +1791,25 @@ public:
         if (object * t = wait_any_check(task_list))
             return t;
         unique_lock<mutex> lock(m_mutex);
-        while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
-        }
+        if (object * t = wait_any_check(task_list))
+            return t;
+        // register on every task of the list and wait for the first one to finish
+        size_t n = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            n++;
+        uint64_t start = task_clock_ns();
+        task_waiter w;
+        std::vector<lean_task_waiter> rs(n);
+        size_t i = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            w.add_to(lean_to_task(lean_ctor_get(it, 0)), rs[i++]);
+        w.m_cv.wait(lock, [&]() { return w.m_woken; });
+        for (lean_task_waiter & r : rs)
+            task_waiter::remove(r);
+        record_blocked_event(start);
+        object * t = wait_any_check(task_list);
+        lean_assert(t);
+        return t;
     }
 
     void deactivate_task(lean_task_object * t) {
@@ -957,10 +1835,38 @@ public:
     bool shutting_down() const {
         return m_shutting_down;
     }
+
+    unsigned get_max_std_workers() const {
+        return m_max_std_workers;
+    }
+
+    /* Returns a value of type `IO.TaskManagerStats`. */
+    object * get_stats() {
+        object * queued = lean_alloc_array(0, LEAN_MAX_PRIO+1);
+        for (atomic<unsigned> & n : m_num_queued)
+            queued = lean_array_push(queued, lean_unsigned_to_nat(n));
+        object * r = lean_alloc_ctor(0, 14, 0);
+        lean_ctor_set(r, 0, lean_unsigned_to_nat(m_num_std_workers));
+        lean_ctor_set(r, 1, lean_unsigned_to_nat(m_sleeping_std_workers));
+        lean_ctor_set(r, 2, lean_unsigned_to_nat(m_max_std_workers));
+        lean_ctor_set(r, 3, lean_unsigned_to_nat(m_num_dedicated_workers));
+        lean_ctor_set(r, 4, queued);
+        lean_ctor_set(r, 5, lean_uint64_to_nat(m_num_tasks_run));
+        lean_ctor_set(r, 6, lean_uint64_to_nat(m_num_blocked_workers));
+        lean_ctor_set(r, 7, lean_uint64_to_nat(m_queued_ns));
+        lean_ctor_set(r, 8, lean_uint64_to_nat(m_run_ns));
+        lean_ctor_set(r, 9, lean_uint64_to_nat(m_idle_ns));
+        set_mark_mt_stats(r);
+        return r;
+    }
 };
 
 static task_manager * g_task_manager = nullptr;
 
+unsigned get_task_manager_num_workers() {
+    return g_task_manager ? g_task_manager->get_max_std_workers() : 0;
+}
+
 extern "C" LEAN_EXPORT void lean_init_task_manager_using(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
 #if defined(LEAN_MULTI_THREAD)
@@ -1006,6 +1912,83 @@ scoped_task_manager::~scoped_task_manager() {
     }
 }
 
+static void wait_for_thunk(b_obj_arg t) {
+    unsigned limit = g_thunk_spin_limit;
+    for (unsigned i = 0; i < limit; i++) {
+        this_thread::yield();
+        if (lean_to_thunk(t)->m_value) {
+            // spinning paid off, allow spinning a little longer next time
+            if (limit < LEAN_THUNK_MAX_SPIN)
+                g_thunk_spin_limit = limit + 1;
+            return;
+        }
+    }
+    // evaluation is taking a while, spin less next time and park
+    g_thunk_spin_limit = std::max(limit / 2, static_cast<unsigned>(LEAN_THUNK_MIN_SPIN));
+    bool in_pool = g_task_manager && g_task_manager->begin_blocking();
+    uint64_t start = task_clock_ns();
+    {
+        thunk_wait_bucket & b = get_thunk_wait_bucket(t);
+        unique_lock<mutex> lock(b.m_mutex);
+        b.m_num_waiters++;
+        b.m_cv.wait(lock, [&]() { return lean_to_thunk(t)->m_value != nullptr; });
+        b.m_num_waiters--;
+    }
+    if (g_task_manager)
+        g_task_manager->end_blocking(in_pool);
+    record_blocked_event(start);
+}
+
+static void record_task_event(task_event_kind kind, unsigned prio, uint64_t queued, uint64_t start, uint64_t end) {
+    task_event_buffer * b = g_task_event_buffer;
+    if (!b) {
+        b = new task_event_buffer();
+        if (g_worker_queue)
+            b->m_name = "worker";
+        else if (g_current_task_object)
+            b->m_name = "dedicated worker";
+        else
+            b->m_name = "thread";
+        lock_guard<mutex> lock(*g_task_event_buffers_mutex);
+        b->m_name += " " + std::to_string(g_task_event_buffers->size());
+        g_task_event_buffers->push_back(b);
+        g_task_event_buffer = b;
+    }
+    lock_guard<mutex> lock(b->m_mutex);
+    b->m_events.push_back({kind, prio, queued, start, end});
+}
+
+/* Writes the recorded events in the Chrome trace event format, with one track per thread. */
+static void write_task_trace(FILE * out) {
+    lock_guard<mutex> lock(*g_task_event_buffers_mutex);
+    fputs("{\"traceEvents\":[\n", out);
+    bool first = true;
+    for (size_t tid = 0; tid < g_task_event_buffers->size(); tid++) {
+        task_event_buffer * b = (*g_task_event_buffers)[tid];
+        lock_guard<mutex> buffer_lock(b->m_mutex);
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", tid, b->m_name.c_str());
+        first = false;
+        for (task_event const & e : b->m_events) {
+            if (e.m_start < g_task_tracing_start)
+                continue;
+            double ts  = (e.m_start - g_task_tracing_start) / 1000.0;
+            double dur = (e.m_end - e.m_start) / 1000.0;
+            if (e.m_kind == task_event_kind::Run) {
+                fprintf(out, ",\n{\"name\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"prio\":%u,\"queued_us\":%.3f}}", tid, ts, dur, e.m_prio, e.m_queued / 1000.0);
+            } else if (e.m_kind == task_event_kind::MarkMt) {
+                fprintf(out, ",\n{\"name\":\"mark_mt\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"objects\":%llu}}", tid, ts, dur, (unsigned long long)e.m_queued);
+            } else {
+                fprintf(out, ",\n{\"name\":\"blocked\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                        tid, ts, dur);
+            }
+        }
+    }
+    fputs("\n]}\n", out);
+}
+
 void deactivate_task(lean_task_object * t) {
     if (g_task_manager) {
         g_task_manager->deactivate_task(t);
@@ -1021,6 +2004,10 @@ static inline void lean_set_task_header(lean_object * o) {
     o->m_tag      = LeanTask;
     o->m_other    = 0;
     o->m_cs_sz    = 0;
+#ifdef LEAN_BIASED_RC
+    o->m_owner     = 0;
+    o->m_shared_rc = 0;
+#endif
 }
 
 static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive) {
@@ -1053,6 +2040,32 @@ extern "C" LEAN_EXPORT obj_res lean_task_spawn_core(obj_arg c, unsigned prio, bo
     }
 }
 
+extern "C" LEAN_EXPORT obj_res lean_task_spawn_many_core(obj_arg cs, unsigned prio, bool keep_alive) {
+    size_t n = lean_array_size(cs);
+    object * r = lean_alloc_array(n, n);
+    if (!g_task_manager) {
+        for (size_t i = 0; i < n; i++) {
+            object * c = lean_array_get_core(cs, i);
+            lean_inc(c);
+            lean_array_set_core(r, i, lean_task_pure(apply_1(c, box(0))));
+        }
+    } else {
+        // mark all closures in one pass so that `alloc_task` does not have to
+        lean_mark_mt(cs);
+        buffer<lean_task_object *> tasks;
+        for (size_t i = 0; i < n; i++) {
+            object * c = lean_array_get_core(cs, i);
+            lean_inc(c);
+            lean_task_object * new_task = alloc_task(c, prio, keep_alive);
+            tasks.push_back(new_task);
+            lean_array_set_core(r, i, (lean_object*)new_task);
+        }
+        g_task_manager->enqueue_many(tasks.data(), n);
+    }
+    lean_dec(cs);
+    return r;
+}
+
 extern "C" LEAN_EXPORT obj_res lean_task_pure(obj_arg a) {
     return (lean_object*)alloc_task(a);
 }
@@ -1130,7 +2143,16 @@ extern "C" LEAN_EXPORT obj_res lean_task_bind_core(obj_arg x, obj_arg f, unsigne
     }
 }
 
+void process_biased_rc_queue() {
+#ifdef LEAN_BIASED_RC
+    brc_process_queue();
+#endif
+}
+
 extern "C" LEAN_EXPORT bool lean_io_check_canceled_core() {
+#ifdef LEAN_BIASED_RC
+    brc_process_queue();
+#endif
     if (lean_task_object * t = g_current_task_object) {
         lean_assert(t->m_imp); // task is being executed
         return t->m_imp->m_canceled || g_task_manager->shutting_down();
@@ -1161,6 +2183,42 @@ extern "C" LEAN_EXPORT b_obj_res lean_io_wait_any_core(b_obj_arg task_list) {
     return g_task_manager->wait_any(task_list);
 }
 
+/* getTaskManagerStats : BaseIO TaskManagerStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_task_manager_stats(obj_arg) {
+    if (g_task_manager)
+        return io_result_mk_ok(g_task_manager->get_stats());
+    object * r = lean_alloc_ctor(0, 14, 0);
+    for (unsigned i = 0; i < 10; i++)
+        lean_ctor_set(r, i, i == 4 ? lean_alloc_array(0, 0) : lean_box(0));
+    set_mark_mt_stats(r);
+    return io_result_mk_ok(r);
+}
+
+/* setTaskTracing (enabled : Bool) : BaseIO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_set_task_tracing(uint8 enabled, obj_arg) {
+    if (enabled && !g_task_tracing) {
+        lock_guard<mutex> lock(*g_task_event_buffers_mutex);
+        for (task_event_buffer * b : *g_task_event_buffers) {
+            lock_guard<mutex> buffer_lock(b->m_mutex);
+            b->m_events.clear();
+        }
+        g_task_tracing_start = task_clock_ns();
+    }
+    g_task_tracing = enabled;
+    return io_result_mk_ok(box(0));
+}
+
+/* writeTaskTrace (fname : @& FilePath) : IO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_write_task_trace(b_obj_arg fname, obj_arg) {
+    FILE * out = fopen(lean_string_cstr(fname), "w");
+    if (!out)
+        return io_result_mk_error(decode_io_error(errno, fname));
+    write_task_trace(out);
+    if (fclose(out) != 0)
+        return io_result_mk_error(decode_io_error(errno, fname));
+    return io_result_mk_ok(box(0));
+}
+
 obj_res lean_promise_new() {
     lean_always_assert(g_task_manager);
 
@@ -2599,6 +3657,25 @@ extern "C" LEAN_EXPORT lean_external_class * lean_register_external_class(lean_e
 void initialize_object() {
     g_ext_classes       = new std::vector<external_object_class*>();
     g_ext_classes_mutex = new mutex();
+    g_thunk_wait_buckets = new thunk_wait_bucket[LEAN_THUNK_WAIT_BUCKETS];
+    g_task_event_buffers_mutex = new mutex();
+    g_task_event_buffers = new std::vector<task_event_buffer *>();
+#if defined(LEAN_MULTI_THREAD)
+    g_mark_mt_pool_class = lean_register_external_class(mark_mt_pool_finalizer, mark_mt_pool_foreach);
+#endif
+#ifdef LEAN_BIASED_RC
+    // not deleted in `finalize_object` since thread finalizers may still run afterwards
+    g_brc_mutex         = new mutex();
+    g_brc_queues        = new std::unordered_map<unsigned, brc_queue *>();
+#endif
+#if defined(LEAN_MULTI_THREAD) && !defined(LEAN_LAZY_RC)
+    if (char const * bg = std::getenv("LEAN_BACKGROUND_DEALLOC")) {
+        if (strcmp(bg, "1") == 0) {
+            g_dealloc_thread = new dealloc_thread();
+            g_bg_dealloc.store(true, std::memory_order_release);
+        }
+    }
+#endif
     g_array_empty       = lean_alloc_array(0, 0);
     mark_persistent(g_array_empty);
 }
@@ -2607,5 +3684,17 @@ void finalize_object() {
     for (external_object_class * cls : *g_ext_classes) delete cls;
     delete g_ext_classes;
     delete g_ext_classes_mutex;
+    delete[] g_thunk_wait_buckets;
+    for (task_event_buffer * b : *g_task_event_buffers) delete b;
+    delete g_task_event_buffers;
+    delete g_task_event_buffers_mutex;
+#if defined(LEAN_MULTI_THREAD) && !defined(LEAN_LAZY_RC)
+    /* `g_dealloc_thread` is not deleted since other threads may still be in `del_mt` and about to call `push`,
+       which fails from now on. */
+    if (g_dealloc_thread) {
+        g_bg_dealloc.store(false);
+        g_dealloc_thread->shutdown();
+    }
+#endif
 }
 }
@@ -483,6 +483,14 @@ extern "C" LEAN_EXPORT obj_res lean_get_or_block(obj_arg opt);
 
 // =======================================
 // Module initialization/finalization
+/* With `LEAN_BIASED_RC`, release the objects owned by the current thread whose last references were
+   dropped by other threads, see `lean_mark_mt`. */
+LEAN_EXPORT void process_biased_rc_queue();
+
+/* Number of standard worker threads of the task manager, `0` if there is no task manager. Parallel
+   runtime operations should not spawn more tasks than this. */
+LEAN_EXPORT unsigned get_task_manager_num_workers();
+
 void initialize_object();
 void finalize_object();
 }
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2025 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstddef>
+#include <utility>
+#include "runtime/debug.h"
+#include "runtime/int.h"
+
+namespace lean {
+/** \brief Hash function for keys that are object pointers, e.g. for caches of traversals keyed by `e.raw()`. */
+struct ptr_hash {
+    size_t operator()(void const * p) const { return reinterpret_cast<size_t>(p) >> 3; }
+};
+
+/** \brief Open addressing hash table with linear probing that only supports insertion and lookup, as needed
+    by traversal caches. Unlike `std::unordered_map`, insertions do not allocate a node each: entries are
+    stored in a single array, which is kept inline in the table itself until it holds more than `N / 2`
+    entries, so that traversals of small terms do not allocate at all.
+
+    The default-constructed key, e.g. `nullptr`, marks empty entries and must not be inserted. `N` must be
+    a power of two. */
+template<typename Entry, typename K, typename Hash, unsigned N>
+class flat_hash_table {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "inline capacity must be a power of two");
+    Entry    m_inline[N];
+    Entry *  m_entries;
+    size_t   m_mask;
+    size_t   m_size;
+    Hash     m_hash;
+
+    size_t index(K const & k) const {
+        // Fibonacci hashing, so that the low bits of the index depend on all bits of the hash
+        return static_cast<size_t>((static_cast<uint64>(m_hash(k)) * 0x9E3779B97F4A7C15ull) >> 32) & m_mask;
+    }
+
+    Entry & probe(Entry * entries, K const & k) const {
+        size_t i = index(k);
+        while (!(entries[i].m_key == k || entries[i].m_key == K()))
+            i = (i + 1) & m_mask;
+        return entries[i];
+    }
+
+    void grow() {
+        size_t old_capacity = m_mask + 1;
+        Entry * old_entries = m_entries;
+        m_entries = new Entry[2 * old_capacity]();
+        m_mask    = 2 * old_capacity - 1;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!(old_entries[i].m_key == K()))
+                probe(m_entries, old_entries[i].m_key) = std::move(old_entries[i]);
+        }
+        if (old_entries != m_inline)
+            delete[] old_entries;
+    }
+protected:
+    /* Return the entry for `k`, or the empty entry at which it should be inserted. */
+    Entry & find_entry(K const & k) const {
+        lean_assert(!(k == K()));
+        return probe(m_entries, k);
+    }
+
+    /* Like `find_entry`, but makes sure there is room for inserting `k`. */
+    Entry & find_entry_for_insert(K const & k) {
+        if (2 * (m_size + 1) > m_mask + 1)
+            grow();
+        return find_entry(k);
+    }
+
+    bool is_empty(Entry const & e) const { return e.m_key == K(); }
+
+    void mark_inserted() { m_size++; }
+public:
+    flat_hash_table():m_inline(), m_entries(m_inline), m_mask(N - 1), m_size(0) {}
+    flat_hash_table(flat_hash_table const &) = delete;
+    flat_hash_table & operator=(flat_hash_table const &) = delete;
+    ~flat_hash_table() {
+        if (m_entries != m_inline)
+            delete[] m_entries;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+};
+
+template<typename K, typename V>
+struct flat_hash_map_entry {
+    K m_key;
+    V m_value;
+};
+
+/** \brief Map variant of `flat_hash_table`. */
+template<typename K, typename V, typename Hash, unsigned N = 8>
+class flat_hash_map : public flat_hash_table<flat_hash_map_entry<K, V>, K, Hash, N> {
+public:
+    /** \brief Return a pointer to the value of `k`, or `nullptr` if it is not in the map. The pointer
+        is invalidated by the next insertion. */
+    V * find(K const & k) {
+        flat_hash_map_entry<K, V> & e = this->find_entry(k);
+        return this->is_empty(e) ? nullptr : &e.m_value;
+    }
+
+    /** \brief Map `k` to `v` unless `k` is already in the map. */
+    void insert(K const & k, V const & v) {
+        flat_hash_map_entry<K, V> & e = this->find_entry_for_insert(k);
+        if (this->is_empty(e)) {
+            e.m_key   = k;
+            e.m_value = v;
+            this->mark_inserted();
+        }
+    }
+};
+
+template<typename K>
+struct flat_hash_set_entry {
+    K m_key;
+};
+
+/** \brief Set variant of `flat_hash_table`. */
+template<typename K, typename Hash, unsigned N = 8>
+class flat_hash_set : public flat_hash_table<flat_hash_set_entry<K>, K, Hash, N> {
+public:
+    bool contains(K const & k) const {
+        return !this->is_empty(this->find_entry(k));
+    }
+
+    /** \brief Insert `k`, and return `true` iff it was not in the set before. */
+    bool insert(K const & k) {
+        flat_hash_set_entry<K> & e = this->find_entry_for_insert(k);
+        if (!this->is_empty(e))
+            return false;
+        e.m_key = k;
+        this->mark_inserted();
+        return true;
+    }
+};
+}
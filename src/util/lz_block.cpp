@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2025 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstring>
+#include <vector>
+#include "util/lz_block.h"
+
+namespace lean {
+static constexpr size_t LZ_MIN_MATCH   = 4;
+static constexpr size_t LZ_MAX_OFFSET  = 0xFFFF;
+static constexpr unsigned LZ_HASH_BITS = 14;
+
+static inline uint32_t lz_read32(uint8_t const * p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t * lz_write_length(uint8_t * op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+static uint8_t * lz_write_sequence(uint8_t * op, uint8_t const * lit, size_t lit_len, size_t offset, size_t match_len) {
+    uint8_t * token = op++;
+    *token = static_cast<uint8_t>((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = lz_write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len > 0) {
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        size_t ml = match_len - LZ_MIN_MATCH;
+        *token |= static_cast<uint8_t>(ml < 15 ? ml : 15);
+        if (ml >= 15)
+            op = lz_write_length(op, ml - 15);
+    }
+    return op;
+}
+
+size_t lz_compress(uint8_t const * src, size_t src_sz, uint8_t * dst) {
+    // positions + 1 of the last occurrence of each hashed 4-byte sequence, 0 if none
+    std::vector<uint32_t> table(size_t(1) << LZ_HASH_BITS, 0);
+    uint8_t * op = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= src_sz) {
+        uint32_t seq = lz_read32(src + i);
+        uint32_t h   = lz_hash(seq);
+        size_t ref   = table[h];
+        table[h]     = static_cast<uint32_t>(i + 1);
+        if (ref != 0 && i - (ref - 1) <= LZ_MAX_OFFSET && lz_read32(src + ref - 1) == seq) {
+            ref--;
+            size_t len = LZ_MIN_MATCH;
+            while (i + len < src_sz && src[ref + len] == src[i + len])
+                len++;
+            op = lz_write_sequence(op, src + anchor, i - anchor, i - ref, len);
+            i += len;
+            anchor = i;
+        } else {
+            // skip faster through incompressible data
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+    op = lz_write_sequence(op, src + anchor, src_sz - anchor, 0, 0);
+    return op - dst;
+}
+
+static bool lz_read_length(uint8_t const * & ip, uint8_t const * end, size_t & len) {
+    uint8_t b;
+    do {
+        if (ip == end)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(uint8_t const * src, size_t src_sz, uint8_t * dst, size_t dst_sz) {
+    uint8_t const * ip  = src;
+    uint8_t const * end = src + src_sz;
+    size_t o = 0;
+    while (ip < end) {
+        uint8_t token  = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz_read_length(ip, end, lit_len))
+            return false;
+        if (lit_len > static_cast<size_t>(end - ip) || lit_len > dst_sz - o)
+            return false;
+        memcpy(dst + o, ip, lit_len);
+        ip += lit_len;
+        o  += lit_len;
+        if (ip == end)
+            break;
+        if (end - ip < 2)
+            return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !lz_read_length(ip, end, match_len))
+            return false;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match_len > dst_sz - o)
+            return false;
+        uint8_t * op        = dst + o;
+        uint8_t const * ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+        } else {
+            // overlapping match, e.g. a run of repeated bytes
+            for (size_t k = 0; k < match_len; k++)
+                op[k] = ref[k];
+        }
+        o += match_len;
+    }
+    return o == dst_sz;
+}
+}
@@ -0,0 +1,28 @@
+/*
+Copyright (c) 2025 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace lean {
+/* A simple and fast LZ77 block codec in the style of LZ4, used for compressed `.olean` files.
+
+   A block is a sequence of sequences. Each sequence starts with a token byte whose upper four bits
+   are the number of literals and whose lower four bits are the match length minus 4. A value of 15
+   is continued by extra bytes that are added to it as long as they are 255. The literals follow the
+   token (and the extra literal length bytes), followed by the match offset as two little-endian bytes
+   and the extra match length bytes. The last sequence of a block consists of literals only. */
+
+/* Upper bound on the compressed size of `sz` bytes. */
+inline size_t lz_compress_bound(size_t sz) { return sz + sz / 255 + 16; }
+
+/* Compress `src_sz` bytes at `src` into `dst`, which must have room for `lz_compress_bound(src_sz)` bytes.
+   Returns the compressed size. */
+size_t lz_compress(uint8_t const * src, size_t src_sz, uint8_t * dst);
+
+/* Decompress the block of `src_sz` bytes at `src` into `dst`. Returns `false` if the block is malformed
+   or does not decompress to exactly `dst_sz` bytes. */
+bool lz_decompress(uint8_t const * src, size_t src_sz, uint8_t * dst, size_t dst_sz);
+}
@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include <utility>
 #include <vector>
 #include <set>
+#include "runtime/alloc.h"
 #include "runtime/stackinfo.h"
 #include "runtime/interrupt.h"
 #include "runtime/memory.h"
@@ -229,7 +230,7 @@ static void display_help(std::ostream & out) {
     std::cout << "      --print-prefix     print the installation prefix for Lean and exit\n";
     std::cout << "      --print-libdir     print the installation directory for Lean's built-in libraries and exit\n";
     std::cout << "      --profile          display elaboration/type checking time for each definition/theorem\n";
-    std::cout << "      --stats            display environment statistics\n";
+    std::cout << "      --stats            display environment and allocator statistics\n";
     DEBUG_CODE(
     std::cout << "      --debug=tag        enable assertions with the given tag\n";
         )
@@ -758,6 +759,7 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
 
         if (stats) {
             env.display_stats();
+            display_alloc_stats(std::cout);
         }
 
         if (run && ok) {
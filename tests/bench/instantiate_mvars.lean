@@ -0,0 +1,26 @@
+import Lean
+
+/-!
+This benchmark exercises the caches of kernel-side term traversals, in particular `instantiateMVars`:
+it builds terms whose metavariable assignments form a long chain of shared subterms and instantiates
+them, then abstracts and instantiates the results again.
+-/
+
+open Lean Meta
+
+def mkChain (n : Nat) : MetaM Expr := do
+  let mut e := mkNatLit 0
+  for i in [0:n] do
+    let m ← mkFreshExprMVar (mkConst ``Nat)
+    m.mvarId!.assign (mkNatAdd e e)
+    e := mkNatAdd m (mkNatLit i)
+  return e
+
+#eval show MetaM Unit from do
+  let mut size := 0
+  for _ in [0:50] do
+    let e ← instantiateMVars (← mkChain 5000)
+    withLocalDeclD `x (mkConst ``Nat) fun x => do
+      let b := (e.replace fun s => if s == mkNatLit 0 then some x else none).abstract #[x]
+      size := size + (b.instantiate1 (mkNatLit 1)).approxDepth.toNat
+  assert! size > 0
@@ -0,0 +1,34 @@
+import Lean.Environment
+import Lean.Util.Path
+
+/-!
+Rewrites all `.olean` files below the directory given as first argument into the directory given as
+second argument, reporting the total size of both and the time spent compacting and writing them. When
+run with `LEAN_OLEAN_COMPRESS=1`, the rewritten files are compressed.
+-/
+
+open Lean
+
+def main (args : List String) : IO Unit := do
+  let [src, dst] := args | throw <| IO.userError "usage: olean_compress <src dir> <dst dir>"
+  let mut srcBytes := 0
+  let mut dstBytes := 0
+  let mut saveNs := 0
+  for f in (← System.FilePath.walkDir src) do
+    unless f.extension == some "olean" do continue
+    let mod ← moduleNameOfFileName f (some src)
+    let out := modToFilePath dst mod "olean"
+    if let some dir := out.parent then
+      IO.FS.createDirAll dir
+    let (data, region) ← readModuleData f
+    unless (← region.hasValidExternalRefs) do
+      throw <| IO.userError s!"{f} references other .olean files that are not loaded"
+    let start ← IO.monoNanosNow
+    saveModuleData out mod data
+    saveNs := saveNs + (← IO.monoNanosNow) - start
+    unsafe region.free
+    srcBytes := srcBytes + (← f.metadata).byteSize.toNat
+    dstBytes := dstBytes + (← out.metadata).byteSize.toNat
+  IO.println s!"bytes .olean: {srcBytes}"
+  IO.println s!"bytes rewritten .olean: {dstBytes}"
+  IO.println s!"save time: {saveNs.toFloat / 1000000000.0}"
@@ -0,0 +1,26 @@
+import Lean.Replay
+import Lean.Util.Path
+
+/-!
+Replays all declarations of `Init` into an empty environment, i.e. checks them again with the kernel,
+sequentially and in parallel, each without and with a shared kernel cache (see
+`Environment.replay`), and reports the time taken by each variant.
+-/
+
+open Lean
+
+def main (_ : List String) : IO Unit := do
+  initSearchPath (← findSysroot)
+  let env ← importModules #[{ module := `Init }] {}
+  let consts := env.constants.map₁.fold (init := {}) fun (m : Std.HashMap Name ConstantInfo) n c => m.insert n c
+  let empty ← mkEmptyEnvironment
+  for parallel in [false, true] do
+    for shared in [false, true] do
+      let sharedCacheSize := if shared then 1000000 else 0
+      let start ← IO.monoNanosNow
+      if parallel then
+        discard <| empty.replayParallel consts (sharedCacheSize := sharedCacheSize)
+      else
+        discard <| empty.replay consts (sharedCacheSize := sharedCacheSize)
+      let secs := (← IO.monoNanosNow) - start |>.toFloat / 1000000000.0
+      IO.println s!"{if parallel then "parallel " else ""}replay{if shared then " shared cache" else ""}: {secs}"
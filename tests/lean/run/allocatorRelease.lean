@@ -0,0 +1,37 @@
+/-!
+The small object allocator returns empty pages to the OS, allocates objects larger than
+`LEAN_MAX_SMALL_OBJECT_SIZE` in medium pages and accepts objects freed by other threads. The default
+build uses mimalloc instead, so these checks only run with the `smallalloc` CMake preset.
+-/
+
+def check (caption : String) (cond : Bool) : IO Unit := do
+  unless cond do
+    throw <| IO.userError s!"check failed: {caption}"
+
+/-- Allocates `n` small objects on another thread. -/
+def allocOnThread (n : Nat) : IO (Array (List Nat)) := do
+  let t ← IO.asTask (prio := .dedicated) do
+    return (Array.range n).map fun i => [i, i + 1]
+  IO.ofExcept t.get
+
+def test : IO Unit := do
+  let s ← IO.getAllocatorStats
+  if s.numHeaps == 0 then
+    return
+  -- objects of another thread's heap freed here
+  let arrs ← allocOnThread 100000
+  check "arrs" (arrs.size == 100000)
+  let s' ← IO.getAllocatorStats
+  check "numRemoteFrees" (s'.numRemoteFrees > s.numRemoteFrees)
+  -- an array of 1000 elements does not fit a small object
+  let big := (List.range 100).map fun i => Array.replicate 1000 i
+  let s ← IO.getAllocatorStats
+  check "medium" (s.liveObjs.any fun (sz, _) => sz > 4096)
+  check "big" (big.length == 100)
+  -- about 40MB of list cells, freed right after
+  let l := (List.range 1000000).map fun i => [i]
+  check "l" (l.length == 1000000)
+  let s' ← IO.getAllocatorStats
+  check "released" (s'.numDecommittedPages > s.numDecommittedPages || s'.numSegments < s.numSegments + 5)
+
+#eval test
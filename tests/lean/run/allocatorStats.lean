@@ -0,0 +1,18 @@
+def check (caption : String) (cond : Bool) : IO Unit := do
+  unless cond do
+    throw <| IO.userError s!"check failed: {caption}"
+
+def test : IO Unit := do
+  let arrs := (List.range 100).map fun i => Array.replicate (1000 + i) i
+  let s ← IO.getAllocatorStats
+  if s.numHeaps > 0 then
+    check "numSegments" (s.numSegments > 0)
+    check "numPages" (s.numPages > 0)
+    check "liveObjs" (s.liveObjs.all fun (sz, n) => sz > 0 && n > 0)
+  else
+    -- runtime built without the small object allocator, live objects are only counted with `ALLOC_STATS`
+    check "numSegments" (s.numSegments == 0)
+    check "liveObjs" (s.liveObjs.all fun (sz, n) => sz > 0 && n > 0)
+  check "arrs" (arrs.length == 100)
+
+#eval test
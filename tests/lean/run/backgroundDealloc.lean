@@ -0,0 +1,38 @@
+/-!
+With `LEAN_BACKGROUND_DEALLOC=1`, large multi-threaded graphs are freed on a reclaim thread. Run a program
+that drops many such graphs, some of them while the process is shutting down, in a child process.
+-/
+
+def check (caption : String) (cond : Bool) : IO Unit := do
+  unless cond do
+    throw <| IO.userError s!"check failed: {caption}"
+
+def prog := r###"
+def main : IO Unit := do
+  let mut sum := 0
+  for i in [0:50] do
+    -- task results are marked as multi-threaded, so the lists are freed by `del_mt`
+    let tasks := (List.range 4).map fun j => Task.spawn fun _ => List.range (10000 + i + j)
+    for t in tasks do
+      sum := sum + t.get.length
+  -- still being freed when `main` returns
+  let _ ← IO.asTask (prio := .dedicated) do
+    let l := (List.range 100000).map fun i => [i]
+    return l.length
+  IO.println sum
+"###
+
+def test : IO Unit := do
+  let lean ← IO.appPath
+  IO.FS.withTempFile fun h path => do
+    h.putStr prog
+    h.flush
+    let out ← IO.Process.output {
+      cmd := lean.toString
+      args := #["--run", path.toString]
+      env := #[("LEAN_BACKGROUND_DEALLOC", "1")]
+    }
+    check s!"exit code {out.exitCode}: {out.stderr}" (out.exitCode == 0)
+    check s!"output {out.stdout}" (out.stdout.trim == "2005200")
+
+#eval test
@@ -0,0 +1,53 @@
+import Lean
+open Lean
+
+/-!
+`saveModuleData` compacts large module data in parallel partitions if the task manager has enough
+workers. The result must be byte-identical to the sequential compaction, which a child process with
+`LEAN_NUM_THREADS=1` uses.
+-/
+
+def resave := r###"
+import Lean.Environment
+open Lean
+
+def main (args : List String) : IO Unit := do
+  let [src, dst] := args | throw <| IO.userError "usage: resave <src> <dst>"
+  let (mod, _) ← readModuleData src
+  saveModuleData dst `Test mod
+"###
+
+def check (caption : String) (cond : Bool) : IO Unit := do
+  unless cond do
+    throw <| IO.userError s!"check failed: {caption}"
+
+/-- Saves the module data in `src` once in this process and once in a child process without workers. -/
+def compareCompactions (src : System.FilePath) : IO Unit :=
+  IO.FS.withTempFile fun h prog =>
+    IO.FS.withTempFile fun _ par =>
+      IO.FS.withTempFile fun _ seq => do
+        h.putStr resave
+        h.flush
+        let (mod, _) ← readModuleData src
+        saveModuleData par `Test mod
+        let out ← IO.Process.output {
+          cmd := (← IO.appPath).toString
+          args := #["--run", prog.toString, src.toString, seq.toString]
+          env := #[("LEAN_NUM_THREADS", "1")]
+        }
+        check s!"sequential compaction: {out.stderr}" (out.exitCode == 0)
+        let parData ← IO.FS.readBinFile par
+        let seqData ← IO.FS.readBinFile seq
+        check s!"parallel and sequential compaction of {src} differ"
+          (parData.size == seqData.size && hash parData == hash seqData)
+
+#eval show CoreM Unit from do
+  let env ← getEnv
+  let mut path? := none
+  for mod in env.header.moduleNames do
+    let path ← findOLean mod
+    if (← path.metadata).byteSize > 4 * 1024 * 1024 then
+      path? := some path
+      break
+  let some src := path? | throwError "no large .olean file found"
+  compareCompactions src
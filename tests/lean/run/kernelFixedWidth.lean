@@ -0,0 +1,37 @@
+/-!
+The kernel evaluates `BitVec`, `UIntN` and `Fin` operations on literals directly.
+These tests check the corner cases of their semantics: overflow, division by zero and large shifts.
+-/
+
+theorem uint8_add : (255 : UInt8) + 1 = 0 := by decide +kernel
+theorem uint8_sub : (3 : UInt8) - 5 = 254 := by decide +kernel
+theorem uint16_mul : (300 : UInt16) * 300 = 24464 := by decide +kernel
+theorem uint32_neg : -(1 : UInt32) = 4294967295 := by decide +kernel
+theorem uint64_div : (0xFFFFFFFFFFFFFFFF : UInt64) / 0 = 0 ∧ (100 : UInt64) / 7 = 14 := by decide +kernel
+theorem uint64_mod : (100 : UInt64) % 0 = 100 ∧ (100 : UInt64) % 7 = 2 := by decide +kernel
+theorem uint64_bitwise :
+    (0xF0F0 : UInt64) &&& 0xFF00 = 0xF000 ∧ (0xF0F0 : UInt64) ||| 0x0F0F = 0xFFFF ∧
+    (0xF0F0 : UInt64) ^^^ 0xFF00 = 0x0FF0 := by decide +kernel
+theorem uint64_shift : (1 : UInt64) <<< 65 = 2 ∧ (4 : UInt64) >>> 66 = 1 := by decide +kernel
+theorem uint64_lt : (3 : UInt64) < 0x8000000000000000 ∧ ¬ (0x8000000000000000 : UInt64) ≤ 3 := by decide +kernel
+theorem uint64_toNat : (UInt64.ofNat (2^64 + 5)).toNat = 5 := by decide +kernel
+
+theorem bitvec_arith : (7#3 + 1#3 = 0#3) ∧ (0#5 - 1#5 = 31#5) ∧ (-(3#4) = 13#4) ∧ (5#8 * 100#8 = 244#8) := by
+  decide +kernel
+theorem bitvec_div : (7#3).udiv 0#3 = 0#3 ∧ (7#3).umod 0#3 = 7#3 := by decide +kernel
+theorem bitvec_shift : (1#8 <<< (8 : Nat) = 0#8) ∧ (1#8 <<< (7 : Nat) = 128#8) ∧
+    (128#8 >>> (7 : Nat) = 1#8) ∧ (128#8 >>> (100 : Nat) = 0#8) := by
+  decide +kernel
+theorem bitvec_cmp : (3#8).ult 200#8 = true ∧ (200#8).ule 3#8 = false := by decide +kernel
+theorem bitvec_wide : BitVec.ofNat 128 (2^127) * 2 = 0 ∧ (BitVec.ofNat 128 (2^128 + 3)).toNat = 3 := by decide +kernel
+
+theorem fin_arith : (3 : Fin 5) + 4 = 2 ∧ (1 : Fin 5) - 3 = 3 ∧ (3 : Fin 5) * 4 = 2 := by decide +kernel
+theorem fin_div : (4 : Fin 5) / 0 = 0 ∧ (4 : Fin 5) % 0 = 4 ∧ (4 : Fin 5) / 3 = 1 := by decide +kernel
+
+/--
+error: tactic 'decide' proved that the proposition
+  255 + 1 = 1
+is false
+-/
+#guard_msgs in
+theorem uint8_add_false : (255 : UInt8) + 1 = 1 := by decide +kernel
@@ -0,0 +1,96 @@
+import Lean
+open Lean
+
+/-!
+The kernel only evaluates `BitVec`, `UIntN` and `Fin` operations on literals directly if their definitions in the
+environment agree with the ones in `Init`. A same-named definition with different semantics is unfolded instead.
+-/
+
+/-- `Fin.mk n v h` with `h : v < n` proved by `decide` -/
+def mkFinLit (n v : Nat) : Expr :=
+  let lt := mkApp4 (mkConst ``LT.lt [levelZero]) (mkConst ``Nat) (mkConst ``instLTNat) (mkRawNatLit v) (mkRawNatLit n)
+  let dec := mkApp2 (mkConst ``Nat.decLt) (mkRawNatLit v) (mkRawNatLit n)
+  let h := mkApp3 (mkConst ``of_decide_eq_true) lt dec
+    (mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Bool) (mkConst ``Bool.true))
+  mkApp3 (mkConst ``Fin.mk) (mkRawNatLit n) (mkRawNatLit v) h
+
+/-- `lhs = rhs` in `α`, proved by `Eq.refl` -/
+def reflThm (name : Name) (α lhs rhs : Expr) : Declaration :=
+  .thmDecl {
+    name, levelParams := []
+    type := mkApp3 (mkConst ``Eq [levelOne]) α lhs rhs
+    value := mkApp2 (mkConst ``Eq.refl [levelOne]) α lhs }
+
+/-- `Fin.add 3 4 = r` in `Fin 5`, proved by `Eq.refl` -/
+def finAddThm (name : Name) (r : Nat) : Declaration :=
+  let lhs := mkApp3 (mkConst ``Fin.add) (mkRawNatLit 5) (mkFinLit 5 3) (mkFinLit 5 4)
+  reflThm name (mkApp (mkConst ``Fin) (mkRawNatLit 5)) lhs (mkFinLit 5 r)
+
+/-- `BitVec.add 200 100 = r` in `BitVec 8`, proved by `Eq.refl` -/
+def bitVecAddThm (name : Name) (r : Nat) : Declaration :=
+  let lit (v : Nat) := mkApp2 (mkConst ``BitVec.ofNat) (mkRawNatLit 8) (mkRawNatLit v)
+  let lhs := mkApp3 (mkConst ``BitVec.add) (mkRawNatLit 8) (lit 200) (lit 100)
+  reflThm name (mkApp (mkConst ``BitVec) (mkRawNatLit 8)) lhs (lit r)
+
+/-- `UInt16.mul 300 300 = r`, proved by `Eq.refl` -/
+def uint16MulThm (name : Name) (r : Nat) : Declaration :=
+  let lit (v : Nat) := mkApp (mkConst ``UInt16.ofNat) (mkRawNatLit v)
+  reflThm name (mkConst ``UInt16) (mkApp2 (mkConst ``UInt16.mul) (lit 300) (lit 300)) (lit r)
+
+/-- Fails unless `decl` is accepted and its check used fixed-width reductions. -/
+def checkReduced (decl : Declaration) : CoreM Unit := do
+  let name := decl.getTopLevelNames.head!
+  let env := (← getEnv).toKernelEnv.enableDiag true (stats := true)
+  match env.addDeclCore 0 decl none with
+  | .ok env  =>
+    let some s := env.diagnostics.reductionStats.find? name | throwError "missing statistics of {name}"
+    unless s.fixedWidthReductions > 0 do
+      throwError "{name} was checked without fixed-width reductions"
+  | .error _ => throwError "unexpected kernel error in {name}"
+
+/-- Fails unless `decl` is rejected. -/
+def checkRejected (decl : Declaration) : CoreM Unit := do
+  if let .ok _ := (← getEnv).toKernelEnv.addDeclCore 0 decl none then
+    throwError "{decl.getTopLevelNames} should have been rejected"
+
+#eval show CoreM Unit from do
+  checkReduced (finAddThm `finAddThm 2)
+  checkRejected (finAddThm `finAddThm 3)
+  checkReduced (bitVecAddThm `bitVecAddThm 44)
+  checkRejected (bitVecAddThm `bitVecAddThm 45)
+  checkReduced (uint16MulThm `uint16MulThm 24464)
+  checkRejected (uint16MulThm `uint16MulThm 24465)
+
+/-- `n` and the declarations it depends on, including the constructors of inductive types -/
+partial def collectDeps (env : Environment) (n : Name) (acc : Std.HashMap Name ConstantInfo) :
+    Std.HashMap Name ConstantInfo := Id.run do
+  if acc.contains n then return acc
+  let some ci := env.find? n | return acc
+  let mut acc := acc.insert n ci
+  let mut deps := ci.getUsedConstantsAsSet
+  if let .inductInfo val := ci then
+    deps := (val.all ++ val.ctors).foldl (·.insert ·) deps
+  for d in deps do
+    acc := collectDeps env d acc
+  return acc
+
+#eval show CoreM Unit from do
+  let env ← getEnv
+  let consts := [``Fin.mk, ``of_decide_eq_true, ``Nat.decLt, ``Nat.add, ``Nat.mod].foldl (init := {})
+    fun acc n => collectDeps env n acc
+  let env ← (← mkEmptyEnvironment).replay consts
+  let fin (n : Expr) := mkApp (mkConst ``Fin) n
+  -- `Fin.add a b := a`
+  let add := Declaration.defnDecl {
+    name := ``Fin.add, levelParams := [], hints := .abbrev, safety := .safe, all := [``Fin.add]
+    type := mkForall `n .implicit (mkConst ``Nat) <|
+      mkForall `a .default (fin (.bvar 0)) <| mkForall `b .default (fin (.bvar 1)) (fin (.bvar 2))
+    value := mkLambda `n .implicit (mkConst ``Nat) <|
+      mkLambda `a .default (fin (.bvar 0)) <| mkLambda `b .default (fin (.bvar 1)) (.bvar 1) }
+  let env ← ofExceptKernelException (env.addDeclCore 0 add none)
+  match env.addDeclCore 0 (finAddThm `finAddThm 3) none with
+  | .ok _    => pure ()
+  | .error _ => throwError "`Fin.add` should have been unfolded"
+  match env.addDeclCore 0 (finAddThm `finAddThm 2) none with
+  | .ok _    => throwError "`Fin.add` should not have been evaluated as in `Init`"
+  | .error _ => pure ()
@@ -0,0 +1,53 @@
+import Lean
+open Lean
+
+def kernelStatsTestDef (n : Nat) : Nat := n + 1
+
+/-!
+The kernel records reduction statistics for each declaration it checks while diagnostics are enabled,
+but only if `diagnostics.kernelStats` is set as well.
+-/
+
+def checkStatsTestThm (diag stats : Bool) : CoreM (Option Kernel.ReductionStats) := do
+  let env := (← getEnv).toKernelEnv.enableDiag diag stats
+  let thm := Declaration.thmDecl {
+    name := `kernelStatsTestThm, levelParams := []
+    type := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) (mkApp (mkConst ``kernelStatsTestDef) (mkNatLit 41)) (mkNatLit 42)
+    value := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) (mkNatLit 42) }
+  match env.addDeclCore 0 thm none with
+  | .ok env    => return env.diagnostics.reductionStats.find? `kernelStatsTestThm
+  | .error _   => throwError "unexpected kernel error"
+
+#eval show CoreM Unit from do
+  let some s ← checkStatsTestThm (diag := true) (stats := true) | throwError "missing statistics"
+  unless s.lazyDeltaSteps > 0 && s.natReductions > 0 do
+    throwError "missing reductions"
+  unless s.whnfCoreCalls ≥ s.whnfCoreCacheHits && s.totalTime ≥ s.whnfTime && s.totalTime > 0 do
+    throwError "inconsistent statistics"
+  if (← checkStatsTestThm (diag := true) (stats := false)).isSome then
+    throwError "statistics collected without `stats`"
+  if (← checkStatsTestThm (diag := false) (stats := true)).isSome then
+    throwError "statistics collected without diagnostics"
+
+/-!
+`diagnostics::record_stats` fills the fields in the order of `reduction_stats::counter` followed by
+`reduction_stats::timer` in `src/kernel/environment.h`, so both must be updated together.
+-/
+#eval show CoreM Unit from do
+  let fields := getStructureFields (← getEnv) ``Kernel.ReductionStats
+  unless fields == #[`whnfCoreCalls, `whnfCoreCacheHits, `whnfCalls, `whnfCacheHits, `inferTypeCalls,
+      `inferTypeCacheHits, `lazyDeltaSteps, `failureCacheHits, `natReductions, `fixedWidthReductions,
+      `etaStructChecks, `etaStructSuccesses, `proofIrrelChecks, `proofIrrelSuccesses,
+      `whnfCoreTime, `whnfTime, `lazyDeltaTime, `natReductionTime, `totalTime] do
+    throwError "`Kernel.ReductionStats` changed, update `reduction_stats` in the kernel: {fields}"
+
+set_option diagnostics true in
+#eval show CoreM Unit from do
+  unless Kernel.isDiagnosticsEnabled (← getEnv) && !Kernel.isDiagnosticsStatsEnabled (← getEnv) do
+    throwError "unexpected diagnostics flags"
+
+set_option diagnostics true in
+set_option diagnostics.kernelStats true in
+#eval show CoreM Unit from do
+  unless Kernel.isDiagnosticsStatsEnabled (← getEnv) do
+    throwError "kernel statistics not enabled"
@@ -0,0 +1,24 @@
+import Lean
+open Lean
+
+/-!
+An `.olean` file that cannot be `mmap`ped at its base address is relocated in chunks of 1MB, in parallel.
+Reading a file again while the imports of this test still have it `mmap`ped takes that path.
+-/
+
+#eval show CoreM Unit from do
+  let env ← getEnv
+  let mut path? := none
+  for mod in env.header.moduleNames do
+    let path ← findOLean mod
+    if (← path.metadata).byteSize > 4 * 1024 * 1024 then
+      path? := some path
+      break
+  let some path := path? | throwError "no .olean file spanning several chunks"
+  let (mod, _) ← readModuleData path
+  unless mod.constNames.size == mod.constants.size && mod.constNames.size > 0 do
+    throwError "unexpected number of constants in {path}"
+  for n in mod.constNames, ci in mod.constants do
+    let some ci' := env.find? n | throwError "unknown constant {n} in {path}"
+    unless ci.name == n && ci.type == ci'.type && ci.value? == ci'.value? do
+      throwError "constant {n} in {path} was not relocated correctly"
@@ -0,0 +1,113 @@
+import Lean
+open Lean
+
+def replayTestDef (n : Nat) : Nat := n + 1
+theorem replayTestThm : replayTestDef 1 = 2 := rfl
+theorem replayTestThm2 : replayTestDef (replayTestDef 1) = 3 := rfl
+
+/-!
+`Environment.replayParallel` should accept the same declarations as `Environment.replay`,
+report a check time for each of them, and reject invalid ones.
+-/
+
+#eval show CoreM Unit from do
+  let env ← getEnv
+  let consts : Std.HashMap Name ConstantInfo := [``replayTestDef, ``replayTestThm].foldl (init := {})
+    fun m n => m.insert n (env.find? n).get!
+  let base ← importModules #[{ module := `Init }] {}
+  let env₁ ← base.replay consts
+  let (env₂, times) ← base.replayParallel consts
+  unless env₁.contains ``replayTestThm && env₂.contains ``replayTestThm do
+    throwError "missing replayed theorem"
+  unless times.map (·.1) == #[``replayTestDef, ``replayTestThm] do
+    throwError "unexpected check times {times.map (·.1)}"
+  let bad : ConstantInfo := .thmInfo {
+    name := `replayTestBad, levelParams := [], all := [`replayTestBad]
+    type := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) (mkNatLit 1) (mkNatLit 2)
+    value := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) (mkNatLit 1) }
+  let ok ← try
+      discard <| base.replayParallel (consts.insert `replayTestBad bad)
+      pure true
+    catch _ => pure false
+  if ok then
+    throwError "invalid theorem accepted"
+  -- also with a kernel cache shared between the checks, which must not be attached to the result
+  let (env₃, _) ← base.replayParallel consts (sharedCacheSize := 1000)
+  unless env₃.contains ``replayTestThm do
+    throwError "missing replayed theorem with shared cache"
+  let env₄ ← base.replay consts (sharedCacheSize := 1000)
+  unless env₄.contains ``replayTestThm do
+    throwError "missing replayed theorem with shared cache"
+  let ok ← try
+      discard <| base.replayParallel (consts.insert `replayTestBad bad) (sharedCacheSize := 1000)
+      pure true
+    catch _ => pure false
+  if ok then
+    throwError "invalid theorem accepted with shared cache"
+  -- an inductive type is checked synchronously, but a failed check of a theorem it depends on, which is
+  -- replayed before it, must be reported first
+  let badTy := mkApp3 (mkConst ``Eq [levelZero]) (mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) (mkNatLit 1) (mkNatLit 2))
+    (mkConst `replayTestBad) (mkConst `replayTestBad)
+  let ind : ConstantInfo := .inductInfo {
+    name := `ReplayTestInd, levelParams := [], type := mkSort levelOne, numParams := 0, numIndices := 0
+    all := [`ReplayTestInd], ctors := [`ReplayTestInd.mk], numNested := 0, isRec := false, isUnsafe := false
+    isReflexive := false }
+  -- the constructor does not return `ReplayTestInd`
+  let ctor : ConstantInfo := .ctorInfo {
+    name := `ReplayTestInd.mk, levelParams := [], type := mkForall `h .default badTy (mkConst ``Nat)
+    induct := `ReplayTestInd, cidx := 0, numParams := 0, numFields := 1, isUnsafe := false }
+  let consts := [bad, ind, ctor].foldl (init := consts) fun m ci => m.insert ci.name ci
+  try
+    discard <| base.replayParallel consts
+    throwError "invalid inductive type accepted"
+  catch e =>
+    let msg ← e.toMessageData.toString
+    unless (msg.splitOn "declaration type mismatch").length > 1 do
+      throwError "expected the error of `replayTestBad`, got: {msg}"
+
+/-!
+The shared kernel cache must return the results of the terms they were computed for: `replayTestThm2`
+and the invalid theorem both reduce `replayTestDef (replayTestDef 1)` and its subterms, which are
+evicted early with a tiny cache.
+-/
+
+#eval show CoreM Unit from do
+  let env ← getEnv
+  let consts : Std.HashMap Name ConstantInfo := [``replayTestDef, ``replayTestThm, ``replayTestThm2].foldl
+    (init := {}) fun m n => m.insert n (env.find? n).get!
+  let lhs := mkApp (mkConst ``replayTestDef) (mkApp (mkConst ``replayTestDef) (mkNatLit 1))
+  let bad : ConstantInfo := .thmInfo {
+    name := `replayTestBad, levelParams := [], all := [`replayTestBad]
+    type := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) lhs (mkNatLit 4)
+    value := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) lhs }
+  let base ← importModules #[{ module := `Init }] {}
+  for sharedCacheSize in [1, 1000] do
+    let env ← base.replay consts (sharedCacheSize := sharedCacheSize)
+    let (env', _) ← base.replayParallel consts (sharedCacheSize := sharedCacheSize)
+    unless env.contains ``replayTestThm2 && env'.contains ``replayTestThm2 do
+      throwError "missing replayed theorem with cache size {sharedCacheSize}"
+    let ok ← try
+        discard <| base.replay (consts.insert `replayTestBad bad) (sharedCacheSize := sharedCacheSize)
+        pure true
+      catch _ => pure false
+    if ok then
+      throwError "invalid theorem accepted with cache size {sharedCacheSize}"
+
+/-!
+Kernel diagnostics count all unfoldings even if a shared cache is attached.
+-/
+
+def unfoldsWithCache (useCache : Bool) : CoreM Nat := do
+  let env := (← getEnv).toKernelEnv.enableDiag true
+  let cache ← Kernel.SharedCache.new 1000
+  let mut env := if useCache then unsafe env.setSharedCache (some cache) else env
+  let some (.thmInfo val) := (← getEnv).find? ``replayTestThm | throwError "unknown theorem"
+  for name in [`replayTestDiag1, `replayTestDiag2] do
+    env ← ofExceptKernelException (env.addDeclCore 0 (.thmDecl { val with name }) none)
+  return env.diagnostics.unfoldCounter.find? ``replayTestDef |>.getD 0
+
+#eval show CoreM Unit from do
+  let n ← unfoldsWithCache false
+  let n' ← unfoldsWithCache true
+  unless n > 0 && n == n' do
+    throwError "unexpected unfold counts {n} and {n'}"
@@ -0,0 +1,22 @@
+def check (caption : String) (cond : Bool) : IO Unit := do
+  unless cond do
+    throw <| IO.userError s!"check failed: {caption}"
+
+def test : IO Unit := do
+  let before ← IO.getTaskManagerStats
+  IO.setTaskTracing true
+  let tasks := (List.range 10).map fun i => Task.spawn fun _ => i * i
+  let sum := tasks.foldl (fun acc t => acc + t.get) 0
+  check "sum" (sum == 285)
+  IO.setTaskTracing false
+  let after ← IO.getTaskManagerStats
+  check "queued" (after.queued.size == before.queued.size)
+  check "markMt" (after.numMarkMtCalls > before.numMarkMtCalls && after.maxMarkMtObjs > 0)
+  if after.numStdWorkers > 0 then
+    check "numTasksRun" (after.numTasksRun ≥ before.numTasksRun + 10)
+  IO.FS.withTempFile fun _ path => do
+    IO.writeTaskTrace path
+    let trace ← IO.FS.readFile path
+    check "trace" (trace.startsWith "{\"traceEvents\":[")
+
+#eval test
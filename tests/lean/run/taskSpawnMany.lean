@@ -0,0 +1,13 @@
+def fns : Array (Unit → Nat) := (Array.range 100).map fun i _ => i * i
+
+/-- info: 328350 -/
+#guard_msgs in
+#eval (Task.spawnMany fns).foldl (fun acc t => acc + t.get) 0
+
+/-- info: 0 -/
+#guard_msgs in
+#eval (Task.spawnMany (#[] : Array (Unit → Nat))).size
+
+/-- info: #[0, 1, 4] -/
+#guard_msgs in
+#eval (Task.spawnMany (fns.extract 0 3) (prio := .dedicated)).map Task.get